@@ -2,6 +2,6 @@
 
 # clean working directory of DISCOTRESS output files
 
-rm walker.*.dat fpp_properties.dat tp_stats.dat
-rm committor_AB.dat committor_BA.dat absorption.dat hitting_probs.dat transient_visits.dat node_visits.dat fundamental.dat mfpt.dat stat_prob_gth.dat
+rm walker.*.dat walker_trajs.bin fpp_properties.dat tp_stats.dat
+rm committor_AB.dat committor_BA.dat absorption.dat hitting_probs.dat transient_visits.dat node_visits.dat fundamental.dat mfpt_allpairs.dat mfpt.dat fpt_moments.dat tpt_flux.dat tpt_nodes.dat path_action.dat path_fingerprints.dat cg_tmtx.dat cg_ratemtx.dat cg_dwell.dat we_flux.dat ffs_interfaces.dat neus_rates.dat neus_weights.dat miles_kernel.dat milestones.dat stat_prob_gth.dat gt_factors.scratch
 rm kmc.out
@@ -30,6 +30,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "debug_tests.h"
 #include <vector>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 
@@ -65,6 +66,8 @@ Discotress::Discotress () {
     }
     omp_set_num_threads(my_kws.nthreads);
     cout << "discotress> simulation will use max of " << my_kws.nthreads << " threads" << endl;
+    if (my_kws.trajcontainer) Traj_container::active = new Traj_container("walker_trajs.bin",my_kws.trajcompress);
+    if (my_kws.asyncio>0) Async_writer::active = new Async_writer(max(my_kws.nthreads,omp_get_max_threads()),my_kws.asyncio);
     long double dummy_randno = Wrapper_Method::rand_unif_met(my_kws.seed); // seed this generator
     if (my_kws.debug) debug=true;
 
@@ -82,7 +85,7 @@ Discotress::Discotress () {
         } else { bins = communities; } // copy community vector to bin vector
     }
     vector<int> nodesAvec, nodesBvec;
-    vector<int> ntrajsvec;
+    vector<int> ntrajsvec, commstargs;
     if (my_kws.wrapper_method!=2) { // simulating the A<-B TPE, read in info on A and B sets
         nodesAvec = Read_files::read_one_col<int>(my_kws.nodesafile.c_str());
         nodesBvec = Read_files::read_one_col<int>(my_kws.nodesbfile.c_str());
@@ -91,11 +94,17 @@ Discotress::Discotress () {
             throw exception();
         }
         cout << "discotress> simulating " << my_kws.nabpaths << " transition paths. Max. no. of iterations: " << my_kws.maxit << endl;
+        if (my_kws.commstargfile!=nullptr) { // read in target number of walkers for each community
+            commstargs = Read_files::read_one_col<int>(my_kws.commstargfile);
+            if (static_cast<int>(commstargs.size())!=my_kws.ncomms) throw exception();
+        }
     } else { // simulating trajectories to obtain data for coarse-graining, read in info on number of trajs for each comm
         ntrajsvec = Read_files::read_one_col<int>(my_kws.ntrajsfile);
         if (ntrajsvec.size()!=my_kws.ncomms) throw exception();
         cout << "discotress> simulating trajectories of max time: " << my_kws.trajt << "   for dimensionality reduction" << endl;
     }
+    vector<double> ffs_order_params;
+    if (my_kws.ffsorderfile!=nullptr) ffs_order_params = Read_files::read_one_col<double>(my_kws.ffsorderfile);
     vector<double> init_probs;
     if (my_kws.initcond) init_probs = Read_files::read_one_col<double>(my_kws.initcondfile);
 
@@ -111,6 +120,9 @@ Discotress::Discotress () {
     }
     cout << "discotress> no. of nodes: " << ktn->n_nodes << "   in A: " << ktn->nodesA.size() << "   in B: " << ktn->nodesB.size() << endl;
     cout << "discotress> no. of edges: " << ktn->n_edges << "      no. of communities: " << ktn->ncomms << endl;
+    ktn->find_sccs();
+    cout << "discotress> no. of strongly connected components: " << ktn->n_sccs;
+    if (ktn->n_sccs>1) { cout << "   (the Markov chain is reducible)" << endl; } else { cout << endl; }
     if (my_kws.dumpwaittimes) ktn->dumpwaittimes();
     if (my_kws.initcond) ktn->set_initcond(init_probs);
     if (my_kws.statereduction && my_kws.pathlengths) { // override mean waiting times to represent mean number of steps to exit
@@ -122,6 +134,7 @@ Discotress::Discotress () {
     cout << "discotress> setting up the object to propagate individual trajectories..." << endl;
     Traj_args traj_args{my_kws.discretetime,my_kws.statereduction,my_kws.tintvl,my_kws.dumpintvls, \
                         my_kws.seed,my_kws.debug};
+    if (my_kws.statereduction && my_kws.pathlengths) traj_args.discretetime=true; // each step has a fixed "duration" of unity
     if (my_kws.traj_method==1) {            // BKL algorithm
         if (my_kws.accumprobs) ktn->set_accumprobs();
         BKL *bkl_ptr = new BKL(*ktn,traj_args);
@@ -130,7 +143,8 @@ Discotress::Discotress () {
         KPS *kps_ptr = new KPS(*ktn,my_kws.nelim,my_kws.kpskmcsteps,my_kws.adaptivecomms,my_kws.adaptminrate,traj_args);
         if (my_kws.statereduction) {
             SR_args sr_args{my_kws.absorption,my_kws.committor,my_kws.fundamentalirred,my_kws.fundamentalred, \
-                            my_kws.gth,my_kws.mfpt};
+                            my_kws.gth,my_kws.mfpt,my_kws.fundblocksz,my_kws.fundstream, \
+                            my_kws.memlimit,my_kws.scratchfile,my_kws.fptmoments,my_kws.tpt};
             kps_ptr->set_statereduction_procs(sr_args);
         }
         traj_method_obj = kps_ptr;
@@ -146,29 +160,42 @@ Discotress::Discotress () {
     bool indepcomms=false; // walkers correspond to independent communities or milestones
     if (my_kws.wrapper_method==2 || my_kws.wrapper_method==6) indepcomms=true;
     Wrapper_args wrapper_args{my_kws.nwalkers,ktn->nbins,my_kws.nabpaths,my_kws.tintvl,my_kws.maxit,indepcomms, \
-                              my_kws.adaptivecomms,my_kws.seed,my_kws.debug};
+                              my_kws.adaptivecomms,my_kws.seed,my_kws.debug,my_kws.nfingerprints,my_kws.fingerprintcomms,my_kws.targeterr};
     if (my_kws.wrapper_method==0) {        // standard simulation of A<-B paths, no enhanced sampling
         wrapper_args.nwalkers=my_kws.nthreads;
         BTOA *btoa_ptr = new BTOA(*ktn,wrapper_args);
         wrapper_method_obj = btoa_ptr;
     } else if (my_kws.wrapper_method==1) { // standard simulation of paths of fixed total time, no enhanced sampling
         if (my_kws.steadystate) wrapper_args.nwalkers=my_kws.nthreads;
-        FIXEDT *fixedt_ptr = new FIXEDT(*ktn,my_kws.trajt,my_kws.steadystate,my_kws.ssrec,wrapper_args);
+        FIXEDT *fixedt_ptr = new FIXEDT(*ktn,my_kws.trajt,my_kws.steadystate,my_kws.ssrec,my_kws.batcht, \
+                                          wrapper_args);
         wrapper_method_obj = fixedt_ptr;
     } else if (my_kws.wrapper_method==2) { // special wrapper to simulate many short nonequilibrium trajectories for dimensionality reduction
-        wrapper_args.nwalkers=my_kws.nthreads;
-        DIMREDN *dimredn_ptr = new DIMREDN(*ktn,ntrajsvec,my_kws.trajt,wrapper_args);
+        wrapper_args.nwalkers=0; // DIMREDN class does not use the walkers vector, each trajectory is simulated by its own walker
+        DIMREDN *dimredn_ptr = new DIMREDN(*ktn,ntrajsvec,my_kws.trajt,my_kws.cglagtimes,wrapper_args);
         wrapper_method_obj = dimredn_ptr;
     } else if (my_kws.wrapper_method==3) { // WE simulation
-        WE *we_ptr = new WE(*ktn,my_kws.taure,wrapper_args);
+        WE *we_ptr = new WE(*ktn,my_kws.taure,commstargs,my_kws.discretetime,wrapper_args);
         wrapper_method_obj = we_ptr;
     } else if (my_kws.wrapper_method==4) { // FFS simulation
+        FFS *ffs_ptr = new FFS(*ktn,my_kws.ffstrials,ffs_order_params,my_kws.ffsinterfaces,my_kws.ffsprune,wrapper_args);
+        wrapper_method_obj = ffs_ptr;
     } else if (my_kws.wrapper_method==5) { // NEUS-kMC simulation
+        wrapper_args.nwalkers=0; // NEUS class does not use the walkers vector, instead each window has its own pool of walkers
+        NEUS *neus_ptr = new NEUS(*ktn,my_kws.nwalkers,my_kws.taure,my_kws.discretetime,wrapper_args);
+        wrapper_method_obj = neus_ptr;
     } else if (my_kws.wrapper_method==6) { // milestoning simulation
+        wrapper_args.nwalkers=0; // MILES class does not use the walkers vector, NWALKERS is the no. of trajectories per milestone
+        MILES *miles_ptr = new MILES(*ktn,my_kws.nwalkers,wrapper_args);
+        wrapper_method_obj = miles_ptr;
     } else if (my_kws.wrapper_method==7) { // recursive enumeration algorithm for k shortest paths problem
         wrapper_args.nwalkers=0; // REA class does not store paths in walkers vector, instead has its own arrays
-        REA *rea_ptr = new REA(*ktn,my_kws.discretetime,my_kws.writerea,my_kws.reanotirred,wrapper_args);
+        REA *rea_ptr = new REA(*ktn,my_kws.discretetime,my_kws.writerea,my_kws.reanotirred,my_kws.deltastep,wrapper_args);
         wrapper_method_obj = rea_ptr;
+    } else if (my_kws.wrapper_method==8) { // Eppstein's algorithm for k shortest paths problem
+        wrapper_args.nwalkers=0; // EPPSTEIN class does not store paths in walkers vector, instead has its own arrays
+        EPPSTEIN *eppstein_ptr = new EPPSTEIN(*ktn,my_kws.discretetime,my_kws.writerea,wrapper_args);
+        wrapper_method_obj = eppstein_ptr;
     } else {
         throw exception(); // a wrapper method object must be set
     }
@@ -177,9 +204,11 @@ Discotress::Discotress () {
 }
 
 Discotress::~Discotress() {
+    if (Async_writer::active) { delete Async_writer::active; Async_writer::active=nullptr; } // write all pending output
     if (wrapper_method_obj) delete wrapper_method_obj;
     if (traj_method_obj) delete traj_method_obj;
     delete ktn;
+    if (Traj_container::active) { delete Traj_container::active; Traj_container::active=nullptr; } // after walkers have flushed their data
     print_discotress_end();
 }
 
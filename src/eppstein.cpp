@@ -0,0 +1,254 @@
+/*
+File containing functions relating to Eppstein's algorithm for the k shortest paths problem.
+
+Here Eppstein's algorithm is used to determine the k first passage A<-B paths of the Markov chain with the highest probability,
+as an alternative to the recursive enumeration algorithm (REA). As in the REA, multiple source and sink nodes are treated by a
+virtual super-source, with transitions to the source nodes weighted by their initial occupation probabilities, and a virtual
+super-sink, with transitions from all sink nodes. See:
+D. Eppstein, "Finding the k shortest paths," SIAM J. Comput. 28, 652-673 (1998).
+The heaps of sidetrack edges are represented as persistent leftist heaps, see:
+H. Kaplan, L. Kozma, O. Zamir and U. Zwick, "Selection from heaps, row-sorted matrices, and X+Y using soft heaps," in 2nd
+Symposium on Simplicity in Algorithms (SOSA 2019), pp. 5:1-5:21.
+
+This file is a part of DISCOTRESS, a software package to simulate the dynamics on arbitrary continuous- and discrete-time Markov chains (CTMCs and DTMCs).
+Copyright (C) 2020 Daniel J. Sharpe
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "kmc_methods.h"
+#include <cmath>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
+using namespace std;
+
+/* constructor for EPPSTEIN derived class */
+EPPSTEIN::EPPSTEIN(const Network &ktn, bool discretetime, bool writerea, const Wrapper_args &wrapper_args) : \
+        Wrapper_Method(wrapper_args) {
+
+    cout << "\n\neppstein> using Eppstein's algorithm to determine the " << wrapper_args.nabpaths << " highest-probability paths" << endl;
+    this->discretetime=discretetime; this->writerea=writerea;
+    source_costs=Wrapper_Method::get_source_costs(ktn);
+    if (ktn.nodesB.size()>1 || ktn.nodesA.size()>1) {
+        cout << "eppstein> paths start from a super-source connected to " << ktn.nodesB.size() << " source nodes and end at a" \
+             << " super-sink connected to " << ktn.nodesA.size() << " sink nodes" << endl; }
+    /* nodes that cannot be reached from the source node without passing through the sink node, or from which the sink node
+       cannot be reached, do not lie on any first passage path and are pruned */
+    vector<bool> fromsource=ktn.get_reachable(ktn.nodesB,true,ktn.nodesA), tosink=ktn.get_reachable(ktn.nodesA,false);
+    pruned.resize(ktn.n_nodes); int n_pruned=0;
+    for (int i=0;i<ktn.n_nodes;i++) {
+        pruned[i]=!(fromsource[i] && tosink[i]);
+        if (pruned[i]) n_pruned++;
+    }
+    if (all_of(ktn.nodesA.begin(),ktn.nodesA.end(),[&](const Node *node_a) { return pruned[node_a->node_id-1]; })) {
+        cout << "eppstein> error: the target node cannot be reached from the initial node" << endl; exit(EXIT_FAILURE); }
+    cout << "eppstein> pruned " << n_pruned << " nodes that do not lie on any first passage path" << endl;
+}
+
+EPPSTEIN::~EPPSTEIN() {}
+
+/* the shortest path tree rooted at the super-sink is computed once, and the heaps of sidetrack edges (i.e. edges not in the tree)
+   are built for all nodes. Each path to the super-sink corresponds to a path in the graph of heap nodes, and the k shortest paths
+   are found by a best-first search of this graph using a priority queue of implicitly represented paths. No recursion is
+   required, and the cost is O(m log n + k log k) for m edges and n nodes */
+void EPPSTEIN::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
+
+    vector<int> tree_order; // nodes in the order in which they are added to the shortest path tree
+    reverse_dijkstra(ktn,tree_order);
+    build_heaps(ktn,tree_order);
+    cout << "eppstein> built heaps of sidetrack edges with " << heap_nodes.size() << " heap nodes in total" << endl;
+    // priority queue of candidate paths, ordered by path cost (ties are broken by the order in which candidates are found)
+    priority_queue<pair<double,int>,vector<pair<double,int>>,greater<pair<double,int>>> candidate_pq;
+    candidate_paths.push_back({hnode:-1,prefix:-1});
+    candidate_pq.push(make_pair(source_costs[source_next->node_id-1]+dist[source_next->node_id-1],0));
+    while (!candidate_pq.empty() && static_cast<int>(shortest_paths.size())<nabpaths) {
+        double cost=candidate_pq.top().first; int c=candidate_pq.top().second; candidate_pq.pop();
+        shortest_paths.push_back(c);
+        int h=candidate_paths[c].hnode, prefix=candidate_paths[c].prefix;
+        if (debug) cout << "path no.: " << shortest_paths.size() << "    cost: " << cost << endl;
+        /* candidates that replace the last sidetrack edge of the current path by the sidetrack edge of a child heap node */
+        if (h>=0) {
+            for (int hchild: {heap_nodes[h].left,heap_nodes[h].right}) {
+                if (hchild<0) continue;
+                candidate_paths.push_back({hnode:hchild,prefix:prefix});
+                candidate_pq.push(make_pair(cost-heap_nodes[h].delta+heap_nodes[hchild].delta,candidate_paths.size()-1));
+            }
+        }
+        /* candidate that appends to the current path the best sidetrack edge from the remainder of the path to the super-sink */
+        int hroot=(h<0)?source_heap:heap_roots[heap_nodes[h].to_node->node_id-1];
+        if (hroot<0) continue;
+        candidate_paths.push_back({hnode:hroot,prefix:c});
+        candidate_pq.push(make_pair(cost+heap_nodes[hroot].delta,candidate_paths.size()-1));
+    }
+    int nspaths=shortest_paths.size();
+    if (nspaths<nabpaths) cout << "eppstein> all " << nspaths << " paths to the target node have been found" << endl;
+    for (int k=1;k<nspaths+1;k++) {
+        // trace the k-th shortest path to compute its properties, accumulated in the same order as in the REA
+        const Node *start_node;
+        vector<const Edge*> path_edges = get_path_edges(k-1,start_node);
+        Walker walker{walker_id:0,path_no:k,k:0,t:0.,p:0.,s:0.};
+        double p=source_costs[start_node->node_id-1], t=0., s=0.;
+        for (const Edge *edgeptr: path_edges) {
+            p -= static_cast<double>(log(edgeptr->t));
+            t += static_cast<double>(edgeptr->from_node->t_esc);
+            if (!discretetime) s += static_cast<double>(edgeptr->rev_edge->k-edgeptr->k);
+        }
+        walker.k=path_edges.size(); walker.p=p; walker.t=t; walker.s=s;
+        walker.dump_fpp_properties();
+        if (writerea) print_shortest_path(ktn,path_edges,start_node,k);
+    }
+}
+
+/* compute the shortest path from all nodes to the super-sink using Dijkstra's algorithm on the reversed network (with lazy
+   deletion of stale entries of the binary heap). A sink node cannot be an intermediate node of any first passage path, so the
+   outgoing edges of sink nodes are ignored. The successor of the super-source is the source node for which the sum of the cost
+   of the virtual transition from the super-source and the cost of the shortest path to the super-sink is lowest */
+void EPPSTEIN::reverse_dijkstra(const Network &ktn, vector<int> &tree_order) {
+    if (debug) cout << "\nreverse Dijkstra's algorithm" << endl;
+    dist.assign(ktn.n_nodes,numeric_limits<double>::infinity());
+    next_edge.assign(ktn.n_nodes,nullptr);
+    vector<bool> insptree(ktn.n_nodes,false);
+    priority_queue<pair<double,int>,vector<pair<double,int>>,greater<pair<double,int>>> dijkstra_pq;
+    for (const Node *node_a: ktn.nodesA) {
+        if (pruned[node_a->node_id-1]) continue;
+        dist[node_a->node_id-1]=0.;
+        dijkstra_pq.push(make_pair(0.,node_a->node_id-1));
+    }
+    while (!dijkstra_pq.empty()) {
+        int n=dijkstra_pq.top().second; dijkstra_pq.pop();
+        if (insptree[n]) continue; // stale entry of the heap
+        insptree[n]=true; tree_order.push_back(n);
+        const Edge *edgeptr=ktn.nodes[n].top_to;
+        while (edgeptr!=nullptr) { // loop over incoming edges
+            int m=edgeptr->from_node->node_id-1;
+            if (pruned[m] || insptree[m] || edgeptr->from_node->aorb==-1 || edgeptr->deadts || edgeptr->t<=0.L) {
+                edgeptr=edgeptr->next_to; continue; }
+            double cost = dist[n] - static_cast<double>(log(edgeptr->t));
+            if (cost<dist[m]) {
+                dist[m]=cost; next_edge[m]=edgeptr;
+                dijkstra_pq.push(make_pair(cost,m));
+            }
+            edgeptr=edgeptr->next_to;
+        }
+    }
+    source_next=nullptr;
+    for (const Node *node_b: ktn.nodesB) {
+        int b=node_b->node_id-1;
+        if (!insptree[b] || source_costs[b]==numeric_limits<double>::infinity()) continue;
+        if (source_next==nullptr || source_costs[b]+dist[b]<source_costs[source_next->node_id-1]+dist[source_next->node_id-1]) {
+            source_next=node_b; }
+    }
+    if (source_next==nullptr) {
+        cout << "eppstein> error: the target node cannot be reached from the initial node" << endl; exit(EXIT_FAILURE); }
+    cout << "eppstein> cost of the shortest path: " << source_costs[source_next->node_id-1]+dist[source_next->node_id-1] << endl;
+}
+
+/* build the heap of sidetrack edges for each node, which contains the sidetrack edges from all nodes along the shortest path from
+   that node to the sink node. This heap is obtained by inserting the sidetrack edges from the node into the heap of its successor
+   node in the shortest path tree, and hence the heaps are built in the order in which nodes were added to the tree. The heap for the
+   super-source is obtained likewise from the virtual transitions to the source nodes */
+void EPPSTEIN::build_heaps(const Network &ktn, const vector<int> &tree_order) {
+    heap_roots.assign(ktn.n_nodes,-1);
+    for (int n: tree_order) {
+        if (ktn.nodes[n].aorb==-1) continue;
+        int h=heap_roots[next_edge[n]->to_node->node_id-1];
+        const Edge *edgeptr=ktn.nodes[n].top_from;
+        while (edgeptr!=nullptr) { // loop over outgoing edges
+            int m=edgeptr->to_node->node_id-1;
+            if (pruned[m] || edgeptr==next_edge[n] || edgeptr->deadts || edgeptr->t<=0.L) {
+                edgeptr=edgeptr->next_from; continue; }
+            // the sidetrack cost is nonnegative, up to numerical error
+            double delta = max(0.,dist[m]-static_cast<double>(log(edgeptr->t))-dist[n]);
+            heap_nodes.push_back({delta:delta,edge:edgeptr,to_node:edgeptr->to_node,left:-1,right:-1,rank:1});
+            h=merge_heaps(h,heap_nodes.size()-1);
+            edgeptr=edgeptr->next_from;
+        }
+        heap_roots[n]=h;
+    }
+    double source_dist=source_costs[source_next->node_id-1]+dist[source_next->node_id-1];
+    source_heap=heap_roots[source_next->node_id-1];
+    for (const Node *node_b: ktn.nodesB) {
+        int b=node_b->node_id-1;
+        if (node_b==source_next || dist[b]==numeric_limits<double>::infinity() || \
+            source_costs[b]==numeric_limits<double>::infinity()) continue;
+        heap_nodes.push_back({delta:max(0.,source_costs[b]+dist[b]-source_dist),edge:nullptr,to_node:node_b,left:-1,right:-1,rank:1});
+        source_heap=merge_heaps(source_heap,heap_nodes.size()-1);
+    }
+}
+
+/* merge two persistent leftist heaps with roots at positions h1 and h2 of the array of heap nodes, and return the position of the
+   root of the merged heap. Heap nodes along the merged right spine are copied, so that neither of the original heaps is modified */
+int EPPSTEIN::merge_heaps(int h1, int h2) {
+    if (h1<0) return h2;
+    if (h2<0) return h1;
+    if (heap_nodes[h2]<heap_nodes[h1]) swap(h1,h2);
+    heap_nodes.push_back(heap_nodes[h1]);
+    int h=heap_nodes.size()-1;
+    int hright=merge_heaps(heap_nodes[h1].right,h2);
+    heap_nodes[h].right=hright;
+    int lrank=(heap_nodes[h].left<0)?0:heap_nodes[heap_nodes[h].left].rank;
+    if (lrank<heap_nodes[hright].rank) swap(heap_nodes[h].left,heap_nodes[h].right);
+    heap_nodes[h].rank=((heap_nodes[h].right<0)?0:heap_nodes[heap_nodes[h].right].rank)+1;
+    return h;
+}
+
+/* recover the sequence of edges of the k-th shortest path (indexed from zero), by following the shortest path tree from the
+   super-source, and from the to node of each sidetrack edge of the path in turn, to the from node of the next sidetrack edge.
+   The virtual transitions from the super-source are not included, instead the first node of the path is returned */
+vector<const Edge*> EPPSTEIN::get_path_edges(int k, const Node *&start_node) const {
+    vector<int> sidetracks;
+    vector<const Edge*> path_edges;
+    for (int c=shortest_paths[k];c>=0 && candidate_paths[c].hnode>=0;c=candidate_paths[c].prefix) {
+        sidetracks.push_back(candidate_paths[c].hnode); }
+    const Node *curr_node=nullptr; // the path begins at the super-source
+    auto follow_tree = [&]() {
+        if (curr_node==nullptr) { curr_node=source_next; start_node=curr_node; return; }
+        path_edges.push_back(next_edge[curr_node->node_id-1]); curr_node=path_edges.back()->to_node;
+    };
+    for (vector<int>::reverse_iterator it=sidetracks.rbegin();it!=sidetracks.rend();++it) {
+        const Sidetrack_heapnode &hnode=heap_nodes[*it];
+        while (curr_node!=((hnode.edge==nullptr)?nullptr:hnode.edge->from_node)) follow_tree();
+        if (hnode.edge==nullptr) { start_node=hnode.to_node; } else { path_edges.push_back(hnode.edge); }
+        curr_node=hnode.to_node;
+    }
+    while (curr_node==nullptr || curr_node->aorb!=-1) follow_tree();
+    return path_edges;
+}
+
+/* print the k-th shortest path from the super-source to the super-sink, in the same format as in the REA (namely, backwards) */
+void EPPSTEIN::print_shortest_path(const Network &ktn, const vector<const Edge*> &path_edges, const Node *start_node, int k) const {
+    ofstream spath_f;
+    string spath_fname="shortest_path."+to_string(k)+".dat";
+    spath_f.open(spath_fname,ios_base::trunc);
+    spath_f.setf(ios::right,ios::adjustfield); spath_f.setf(ios::scientific,ios::floatfield);
+    spath_f.precision(10);
+    // accumulate the path properties along the path, then print from the sink node back to the source node
+    vector<REA_path> path_steps(1,{p:source_costs[start_node->node_id-1],t:0.,s:0.,pred_node:-1,pred_rank:0,k:0});
+    for (const Edge *edgeptr: path_edges) {
+        const REA_path &prev_step=path_steps.back();
+        REA_path step{p:prev_step.p-static_cast<double>(log(edgeptr->t)),t:prev_step.t+static_cast<double>(edgeptr->from_node->t_esc), \
+                      s:prev_step.s,pred_node:edgeptr->from_node->node_id-1,pred_rank:1,k:prev_step.k+1};
+        if (!discretetime) step.s += static_cast<double>(edgeptr->rev_edge->k-edgeptr->k);
+        path_steps.push_back(step);
+    }
+    for (int i=path_edges.size();i>=0;i--) {
+        const Node *node=(i>0)?path_edges[i-1]->to_node:start_node;
+        const REA_path &step=path_steps[i];
+        spath_f << setw(7) << node->node_id << setw(7) << node->comm_id;
+        spath_f << setw(25) << step.t << setw(30) << step.k << setw(25) << step.p << setw(25) << step.s << endl;
+    }
+}
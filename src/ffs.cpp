@@ -24,13 +24,160 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "kmc_methods.h"
+#include <omp.h>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
 
 using namespace std;
 
-FFS::FFS(const Network &ktn, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {}
+/* the order parameter is either specified for each node, or is the community ID of each node (negated if the community ID of
+   A is less than that of B). If the values of the order parameter at the interfaces are not specified, then there is an
+   interface at each community between the communities of B and A */
+FFS::FFS(const Network &ktn, int ntrials, const vector<double> &order_params, const vector<double> &interfaces, double pprune, \
+         const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+
+    cout << "ffs> setting up forward flux sampling simulation" << endl;
+    this->ntrials=ntrials; this->order_params=order_params; this->interfaces=interfaces; this->pprune=pprune;
+    int comm_a=(*ktn.nodesA.begin())->comm_id, comm_b=(*ktn.nodesB.begin())->comm_id;
+    int sign=(comm_a>comm_b)?1:-1;
+    if (this->order_params.empty()) {
+        for (const Node &node: ktn.nodes) this->order_params.push_back(static_cast<double>(sign*node.comm_id)); }
+    if (static_cast<int>(this->order_params.size())!=ktn.n_nodes) {
+        cout << "ffs> error: no. of order parameter values is not equal to the no. of nodes" << endl; exit(EXIT_FAILURE); }
+    if (this->interfaces.empty()) {
+        for (int i=sign*comm_b+1;i<sign*comm_a;i++) this->interfaces.push_back(static_cast<double>(i)); }
+    if (this->interfaces.empty()) {
+        cout << "ffs> error: there must be at least one interface between the B and A sets" << endl; exit(EXIT_FAILURE); }
+    for (const Node *node: ktn.nodesB) {
+        if (this->order_params[node->node_pos]>=this->interfaces[0]) {
+            cout << "ffs> error: nodes of the B set must be on the B side of the first interface" << endl; exit(EXIT_FAILURE); }
+    }
+    pools.resize(this->interfaces.size()+1);
+    cout << "ffs> no. of interfaces: " << this->interfaces.size() << " \tno. of configurations at first interface: " \
+         << walkers.size() << " \tno. of trials per interface: " << ntrials << endl;
+    if (pprune>0.) cout << "ffs> trial trajectories that fall back across earlier interfaces are pruned with probability " \
+                        << pprune << endl;
+}
 
 FFS::~FFS() {}
 
+/* direct FFS. The flux of trajectories out of B across the first interface is estimated, and the configurations at the
+   crossings are stored. Trial trajectories are then fired from randomly chosen configurations at each interface in turn, until
+   they either cross the next interface (and the configuration is stored) or return to B. The A<-B rate constant is the product
+   of the initial flux and of the conditional probabilities of reaching each interface from the previous interface. If trials
+   are pruned, then the configurations carry statistical weights, and the conditional probabilities are the total weights of
+   the successful trials divided by the no. of trials */
 void FFS::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
+    cout << "\n\nffs> beginning forward flux sampling simulation" << endl;
+    long double flux=initial_flux(ktn,traj_method_obj);
+    cout << "ffs> flux across the first interface: " << flux << endl;
+    ofstream ffs_f; ffs_f.open("ffs_interfaces.dat");
+    ffs_f.setf(ios::right,ios::adjustfield); ffs_f.setf(ios::scientific,ios::floatfield);
+    ffs_f.precision(10);
+    long double cum_prob=1.L; // probability of reaching the current interface from the first interface
+    n_ab=0;
+    for (int i=1;i<=static_cast<int>(interfaces.size());i++) {
+        int nsuccesses=fire_trials(ktn,traj_method_obj,i);
+        long double cond_prob=(nsuccesses>0?pools[i].back().second:0.L)/static_cast<long double>(ntrials);
+        cum_prob*=cond_prob;
+        ffs_f << setw(7) << i << setw(20) << (i<static_cast<int>(interfaces.size())?interfaces[i]:numeric_limits<double>::infinity()) \
+              << setw(10) << pools[i-1].size() << setw(10) << ntrials << setw(10) << nsuccesses << setw(20) << cond_prob \
+              << setw(20) << cum_prob << "\n";
+        cout << "ffs> interface " << i << ": " << nsuccesses << " of " << ntrials << " trials succeeded" << endl;
+        if (nsuccesses==0) {
+            cout << "ffs> no trial trajectories reached interface " << i << ", the estimated rate constant is zero" << endl;
+            break; }
+        if (i==static_cast<int>(interfaces.size())) n_ab=nsuccesses;
+    }
+    cout << "ffs> finished forward flux sampling simulation. " << n_ab << " trial trajectories reached A" << endl;
+    cout << "ffs> estimated A<-B rate constant: " << flux*cum_prob << endl;
+}
+
+/* trajectory crosses interface i (or reaches the final interface, i.e. the A set) */
+bool FFS::crossed_interface(const Node *node, int i) const {
+    if (node->aorb==-1) return true;
+    return i<static_cast<int>(interfaces.size()) && order_params[node->node_pos]>=interfaces[i];
+}
+
+/* simulate cycles that start from B, cross the first interface (where the configuration is stored) and then return to B (or
+   reach A). Each cycle is a separate task, so that the configurations do not depend on the no. of threads. The flux is the
+   no. of crossings per unit time. A cycle that reaches A without having crossed the first interface (which is possible only
+   if the first interface does not separate B from A) contributes to the total time but not to the crossings */
+long double FFS::initial_flux(const Network &ktn, Traj_Method *traj_method_obj) {
+
+    vector<long double> cycle_times(walkers.size());
+    vector<int> cycle_configs(walkers.size(),-1); // configuration at the first interface for each cycle (-1 if not crossed)
+    Path_scheduler task_scheduler(walkers.size(),omp_get_max_threads());
+    #pragma omp parallel
+    {
+    Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+    int task_id;
+    while (task_scheduler.next_path(omp_get_thread_num(),task_id)) {
+        Walker walker{walker_id:0,path_no:task_id,k:0,t:0.L,p:-numeric_limits<double>::infinity(),s:0.L};
+        walker.visited.resize(ktn.nbins);
+        Task_rng task_rng(seed,0,task_id);
+        get_initial_node(ktn,walker,seed);
+        do {
+            traj_method_local->kmc_iteration(ktn,walker);
+            if (cycle_configs[task_id]==-1 && walker.curr_node->aorb!=-1 && crossed_interface(walker.curr_node,0)) {
+                cycle_configs[task_id]=walker.curr_node->node_pos; }
+        } while (walker.curr_node->aorb==0 || (walker.curr_node->aorb==1 && cycle_configs[task_id]==-1));
+        cycle_times[task_id]=walker.t;
+    }
+    delete traj_method_local;
+    }
+    long double tot_time=0.L;
+    for (long double cycle_time: cycle_times) tot_time+=cycle_time;
+    pools[0].clear();
+    for (int config: cycle_configs) {
+        if (config!=-1) pools[0].push_back(make_pair(config,pools[0].size()+1.L)); }
+    if (pools[0].size()<walkers.size()) {
+        cout << "ffs> warning: " << walkers.size()-pools[0].size() << " cycles reached A without crossing the first interface" << endl; }
+    if (pools[0].empty()) {
+        cout << "ffs> error: no cycles crossed the first interface" << endl; exit(EXIT_FAILURE); }
+    return static_cast<long double>(pools[0].size())/tot_time;
+}
+
+/* fire trial trajectories from configurations at interface i-1 (chosen in proportion to their weights), which are propagated
+   until they cross interface i or return to B. Each trial is a separate task. If pruning is used, then each time that a trial
+   falls back across one of the interfaces i-2, i-3, ..., 0, it is terminated with probability pprune (as a failure), and
+   otherwise its weight is multiplied by 1/(1-pprune), so that the estimated conditional probability remains unbiased, while
+   less time is spent on trials that are returning to B. The configurations of successful trials are stored, in order of the
+   trial IDs and with cumulative weights, in the pool for interface i. Returns the no. of successful trials */
+int FFS::fire_trials(const Network &ktn, Traj_Method *traj_method_obj, int i) {
+
+    vector<pair<int,long double>> trial_configs(ntrials,make_pair(-1,0.L)); // configuration at interface i and weight for each trial
+    Path_scheduler task_scheduler(ntrials,omp_get_max_threads());
+    #pragma omp parallel
+    {
+    Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+    int task_id;
+    while (task_scheduler.next_path(omp_get_thread_num(),task_id)) {
+        Walker walker{walker_id:i,path_no:task_id,k:0,t:0.L,p:-numeric_limits<double>::infinity(),s:0.L};
+        walker.visited.resize(ktn.nbins);
+        Task_rng task_rng(seed,i,task_id);
+        walker.curr_node=&ktn.nodes[sample_cum_distribn(pools[i-1],seed)]; walker.prev_node=walker.curr_node;
+        long double weight=1.L;
+        int next_back=i-2; // next earlier interface at which the trial may be pruned
+        for (;;) {
+            traj_method_local->kmc_iteration(ktn,walker);
+            if (crossed_interface(walker.curr_node,i)) { trial_configs[task_id]=make_pair(walker.curr_node->node_pos,weight); break; }
+            if (walker.curr_node->aorb==1) break;
+            bool pruned=false;
+            while (pprune>0. && next_back>=0 && order_params[walker.curr_node->node_pos]<interfaces[next_back]) {
+                if (rand_unif_met(seed)<pprune) { pruned=true; break; }
+                weight/=1.L-pprune; next_back--;
+            }
+            if (pruned) break;
+        }
+    }
+    delete traj_method_local;
+    }
+    long double cum_weight=0.L;
+    for (const pair<int,long double> &config: trial_configs) {
+        if (config.first==-1) continue;
+        cum_weight+=config.second; pools[i].push_back(make_pair(config.first,cum_weight)); }
+    return pools[i].size();
 }
@@ -24,7 +24,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
 #include <cstring>
+#include <cmath>
 #include <iostream>
 #include <assert.h>
 
@@ -66,6 +68,8 @@ Keywords read_keywords(const char *kw_file) {
                 my_kws.wrapper_method=6;
             } else if (vecstr[1]=="REA") {
                 my_kws.wrapper_method=7;
+            } else if (vecstr[1]=="EPPSTEIN") {
+                my_kws.wrapper_method=8;
             } else { cout << "unrecognised WRAPPER option" << endl; exit(EXIT_FAILURE); }
         } else if (vecstr[0]=="TRAJ") {
             if (vecstr[1]=="BKL") {
@@ -94,6 +98,12 @@ Keywords read_keywords(const char *kw_file) {
             my_kws.ncomms=stoi(vecstr[2]);
         } else if (vecstr[0]=="DUMPINTVLS") {
             my_kws.dumpintvls=true;
+        } else if (vecstr[0]=="FINGERPRINT") {
+            my_kws.nfingerprints=stoi(vecstr[1]);
+            if (vecstr.size()>2) {
+                if (vecstr[2]=="COMMS") { my_kws.fingerprintcomms=true;
+                } else { cout << "unrecognised FINGERPRINT option" << endl; exit(EXIT_FAILURE); }
+            }
         } else if (vecstr[0]=="INITCONDFILE") {
             my_kws.initcondfile = new char[vecstr[1].size()+1];
             copy(vecstr[1].begin(),vecstr[1].end(),my_kws.initcondfile);
@@ -103,12 +113,23 @@ Keywords read_keywords(const char *kw_file) {
             my_kws.maxit=stoi(vecstr[1]);
         } else if (vecstr[0]=="NABPATHS") {
             my_kws.nabpaths=stoi(vecstr[1]);
+        } else if (vecstr[0]=="TARGETERR") {
+            my_kws.targeterr=stod(vecstr[1]);
+            if (vecstr.size()>2) my_kws.batcht=stod(vecstr[2]);
         } else if (vecstr[0]=="TINTVL") {
             my_kws.tintvl=stod(vecstr[1]);
+        } else if (vecstr[0]=="TRAJCONTAINER") {
+            my_kws.trajcontainer=true;
+            if (vecstr.size()>1) {
+                if (vecstr[1]=="COMPRESS") { my_kws.trajcompress=true;
+                } else { cout << "keywords> error: invalid argument to TRAJCONTAINER" << endl; exit(EXIT_FAILURE); }
+            }
         // optional keywords relating to enhanced sampling methods
         } else if (vecstr[0]=="ADAPTIVECOMMS") {
             my_kws.adaptivecomms=true;
             my_kws.adaptminrate=stod(vecstr[1]);
+        } else if (vecstr[0]=="CGLAGTIMES") {
+            for (int i=1;i<static_cast<int>(vecstr.size());i++) my_kws.cglagtimes.push_back(stod(vecstr[i]));
         } else if (vecstr[0]=="COMMSTARGFILE") {
             my_kws.commstargfile = new char[vecstr[1].size()+1];
             copy(vecstr[1].begin(),vecstr[1].end(),my_kws.commstargfile);
@@ -123,8 +144,20 @@ Keywords read_keywords(const char *kw_file) {
             my_kws.meanrate=true;
         } else if (vecstr[0]=="NELIM") {
             my_kws.nelim=stoi(vecstr[1]);
+        } else if (vecstr[0]=="FFSTRIALS") {
+            my_kws.ffstrials=stoi(vecstr[1]);
+        } else if (vecstr[0]=="FFSORDERFILE") {
+            my_kws.ffsorderfile = new char[vecstr[1].size()+1];
+            copy(vecstr[1].begin(),vecstr[1].end(),my_kws.ffsorderfile);
+            my_kws.ffsorderfile[vecstr[1].size()]='\0';
+        } else if (vecstr[0]=="FFSINTERFACES") {
+            for (int i=1;i<static_cast<int>(vecstr.size());i++) my_kws.ffsinterfaces.push_back(stod(vecstr[i]));
+        } else if (vecstr[0]=="FFSPRUNE") {
+            my_kws.ffsprune=stod(vecstr[1]);
         } else if (vecstr[0]=="NWALKERS") {
             my_kws.nwalkers=stoi(vecstr[1]);
+        } else if (vecstr[0]=="DELTASTEP") {
+            my_kws.deltastep=(vecstr.size()>1)?stod(vecstr[1]):0.;
 	} else if (vecstr[0]=="REANOTIRRED") {
 	    my_kws.reanotirred=true;
 	} else if (vecstr[0]=="STEADYSTATE") {
@@ -145,15 +178,32 @@ Keywords read_keywords(const char *kw_file) {
             my_kws.fundamentalirred=true;
         } else if (vecstr[0]=="FUNDAMENTALRED") {
             my_kws.fundamentalred=true;
+        } else if (vecstr[0]=="FUNDBLOCKSZ") {
+            my_kws.fundblocksz=stoi(vecstr[1]);
+        } else if (vecstr[0]=="FUNDSTREAM") {
+            my_kws.fundstream=true;
+        } else if (vecstr[0]=="FPTMOMENTS") {
+            my_kws.fptmoments=true;
         } else if (vecstr[0]=="GTH") {
             my_kws.gth=true;
+        } else if (vecstr[0]=="MEMLIMIT") {
+            my_kws.memlimit=stod(vecstr[1]);
+            if (vecstr.size()>2) {
+                my_kws.scratchfile = new char[vecstr[2].size()+1];
+                copy(vecstr[2].begin(),vecstr[2].end(),my_kws.scratchfile);
+                my_kws.scratchfile[vecstr[2].size()]='\0'; }
         } else if (vecstr[0]=="MFPT") {
             my_kws.mfpt=true;
         } else if (vecstr[0]=="PATHLENGTHS") {
             my_kws.pathlengths=true;
+        } else if (vecstr[0]=="TPT") {
+            my_kws.tpt=true;
         // other optional keywords
         } else if (vecstr[0]=="ACCUMPROBS") {
             my_kws.accumprobs=true;
+        } else if (vecstr[0]=="ASYNCIO") {
+            my_kws.asyncio=1<<16;
+            if (vecstr.size()>1) my_kws.asyncio=stoi(vecstr[1]);
         } else if (vecstr[0]=="BRANCHPROBS") {
             my_kws.branchprobs=true;
         } else if (vecstr[0]=="DEBUG") {
@@ -186,12 +236,20 @@ Keywords read_keywords(const char *kw_file) {
 void Keywords::check_keywords() {
     if (n_nodes<=0 || n_edges<=0 || ((nA<=0 || nB<=0) && wrapper_method!=2)) {
         cout << "keywords> error: network parameters not set correctly" << endl; exit(EXIT_FAILURE); }
-    if ((nabpaths<=0 && wrapper_method!=2) || maxit<=0) {
+    if ((nabpaths<=0 && wrapper_method!=2 && wrapper_method!=6) || (maxit<=0 && wrapper_method!=6)) {
         cout << "keywords> error: termination condition not specified correctly" << endl; exit(EXIT_FAILURE); }
     if (commsfile!=nullptr && ncomms<=1) {
         cout << "keywords> error: there must be at least two communities in the specified partitioning" << endl; exit(EXIT_FAILURE); }
     if (dumpintvls && tintvl<=0.) {
         cout << "keywords> error: invalid time interval for dumping trajectory data" << endl; exit(EXIT_FAILURE); }
+    if (nfingerprints<0 || (nfingerprints>0 && wrapper_method!=0) || (fingerprintcomms && commsfile==nullptr)) {
+        cout << "keywords> error: path fingerprinting not specified correctly" << endl; exit(EXIT_FAILURE); }
+    if (asyncio<0) {
+        cout << "keywords> error: invalid ring buffer capacity for asynchronous output" << endl; exit(EXIT_FAILURE); }
+    if (ffsprune!=0. && wrapper_method!=4) {
+        cout << "keywords> error: FFSPRUNE can only be used with WRAPPER FFS" << endl; exit(EXIT_FAILURE); }
+    if (!cglagtimes.empty() && wrapper_method!=2) {
+        cout << "keywords> error: CGLAGTIMES can only be used with WRAPPER DIMREDN" << endl; exit(EXIT_FAILURE); }
     if (traj_method<=0 || wrapper_method<0) {
         cout << "keywords> error: must specify both a wrapper method and a trajectory method" << endl; exit(EXIT_FAILURE); }
     if ((discretetime || !branchprobs) && tau<=0.) {
@@ -210,9 +268,34 @@ void Keywords::check_keywords() {
             cout << "keywords> error: computation of the fundamental matrix for a reducible Markov chain is standalone" << endl; exit(EXIT_FAILURE); }
         if (n_nodes-nA>nelim) {
             cout << "keywords> error: for state reduction must set NELIM to ensure that all nodes not in A are eliminated" << endl; exit(EXIT_FAILURE); }
+        if (fundblocksz<1) {
+            cout << "keywords> error: the block size for computation of the fundamental matrix must be positive" << endl; exit(EXIT_FAILURE); }
+        if (memlimit>0. && (absorption || fundamentalirred || fundamentalred || gth)) {
+            cout << "keywords> error: out-of-core state reduction is available only for the COMMITTOR and MFPT computations" << endl; exit(EXIT_FAILURE); }
+        if (fptmoments && (!mfpt || absorption || fundamentalirred || gth)) {
+            cout << "keywords> error: FPTMOMENTS must be used with MFPT, and is not compatible with ABSORPTION, FUNDAMENTALIRRED or GTH" << endl; exit(EXIT_FAILURE); }
+        /* the RHS of the FPT moment equations for a DTMC assumes steps of fixed duration, which is invalid after the self-loops have
+           been subsumed into geometrically distributed waiting times (path lengths, counting moves between distinct nodes, are unaffected) */
+        if (fptmoments && discretetime && noloop && !pathlengths) {
+            cout << "keywords> error: FPTMOMENTS cannot be used for a DTMC with NOLOOP, unless PATHLENGTHS is also set" << endl; exit(EXIT_FAILURE); }
         statereduction=true;
-        nthreads=1; // use only a single thread for a state reduction computation
+        /* use only a single thread for a state reduction computation, except for the blocked computation of the fundamental matrix
+           the sparse COMMITTOR and MFPT computations (which are parallelised over independent components, and are used unless
+           ABSORPTION or GTH is set), and the computation of reactive fluxes (which is parallelised over edges) */
+        if (!fundamentalirred && !fundamentalred && memlimit<=0. && !fptmoments && !tpt && (absorption || gth)) nthreads=1;
     }
+    if (memlimit>0. && !statereduction) {
+        cout << "keywords> error: MEMLIMIT can only be used in conjunction with a state reduction computation" << endl; exit(EXIT_FAILURE); }
+    if (tpt && !committor) {
+        cout << "keywords> error: TPT can only be used in conjunction with the COMMITTOR state reduction computation" << endl; exit(EXIT_FAILURE); }
+    if (fptmoments && !statereduction) {
+        cout << "keywords> error: FPTMOMENTS can only be used in conjunction with the MFPT state reduction computation" << endl; exit(EXIT_FAILURE); }
+    if (targeterr<0. || batcht<0. || (targeterr>0. && (wrapper_method>2 || statereduction)) || \
+        (targeterr>0. && wrapper_method==1 && !steadystate) || (batcht>0. && wrapper_method!=1)) {
+        cout << "keywords> error: convergence-driven termination (TARGETERR) not specified correctly" << endl; exit(EXIT_FAILURE); }
+    if (batcht>trajt-ssrec) {
+        cout << "keywords> error: the length of batches for the batch means estimate exceeds the recording period of the trajectory" \
+             << endl; exit(EXIT_FAILURE); }
     // check specification of wrapper method is valid
     if (wrapper_method==0) { // standard simulation of paths initialised in state B and terminating when state A is hit
         // ...
@@ -222,24 +305,37 @@ void Keywords::check_keywords() {
             cout << "keywords> error: simulation of fixed-time paths not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==2) { // special wrapper method to propagate trajectories required for dimensionality reduction
         if (ntrajsfile==nullptr || trajt<=0. || commsfile==nullptr || meanrate || initcondfile || \
-            traj_method==1 || nA!=0 || nB!=0 || !dumpintvls) {
+            traj_method==1 || nA!=0 || nB!=0 || (!dumpintvls && cglagtimes.empty())) {
             cout << "keywords> error: dimensionality reduction simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
+        if (!cglagtimes.empty()) { // lag times must be multiples of the time interval of the discretised trajectories
+            double tunit = tintvl>0.?tintvl:*min_element(cglagtimes.begin(),cglagtimes.end());
+            for (double cglagtime: cglagtimes) {
+                if (tunit<=0. || cglagtime<=0. || fabs(cglagtime/tunit-round(cglagtime/tunit))>1.E-06) {
+                    cout << "keywords> error: lag times for coarse-grained transition matrices not specified correctly" << endl;
+                    exit(EXIT_FAILURE); }
+            }
+        }
     } else if (wrapper_method==3) { // WE simulation
-        if (taure<=0. || (commsfile!=nullptr && !adaptivecomms) || nwalkers<1 || \
-            (commstargfile!=nullptr && !adaptivecomms) || traj_method!=1) {
+        if (taure<=0. || commsfile==nullptr || commstargfile==nullptr || adaptivecomms || nwalkers<1 || traj_method!=1) {
             cout << "keywords> error: WE simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==4) { // FFS simulation
-        if (commsfile==nullptr) {
+        if ((commsfile==nullptr && ffsorderfile==nullptr) || (ffsorderfile!=nullptr && ffsinterfaces.empty()) || \
+            ffstrials<1 || nwalkers<1 || traj_method!=1 || ffsprune<0. || ffsprune>=1. || \
+            !is_sorted(ffsinterfaces.begin(),ffsinterfaces.end()) || \
+            adjacent_find(ffsinterfaces.begin(),ffsinterfaces.end())!=ffsinterfaces.end()) {
             cout << "keywords> error: FFS simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==5) { // NEUS simulation
-        if (commsfile==nullptr || traj_method!=1 || nwalkers<1) {
+        if (commsfile==nullptr || traj_method!=1 || nwalkers<1 || taure<=0. || adaptivecomms) {
             cout << "keywords> error: NEUS simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==6) { // milestoning simulation
-        if (commsfile==nullptr || nwalkers<1) {
+        if (commsfile==nullptr || nwalkers<1 || traj_method!=1 || adaptivecomms) {
             cout << "keywords> error: milestoning simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==7) { // recursive enumeration algorithm for k shortest paths
-        if (nA!=1 || nB!=1 || nabpaths<1 || (discretetime && !noloop) || (!discretetime && !branchprobs)) {
+        if (nabpaths<1 || (discretetime && !noloop) || (!discretetime && !branchprobs)) {
             cout << "keywords> error: REA k shortest paths computation not specified correctly" << endl; exit(EXIT_FAILURE); }
+    } else if (wrapper_method==8) { // Eppstein's algorithm for k shortest paths
+        if (nabpaths<1 || (discretetime && !noloop) || (!discretetime && !branchprobs) || deltastep>=0.) {
+            cout << "keywords> error: Eppstein k shortest paths computation not specified correctly" << endl; exit(EXIT_FAILURE); }
     }
     // check specification of trajectory method is valid
     if (traj_method==1) { // BKL algorithm
@@ -248,7 +344,7 @@ void Keywords::check_keywords() {
         if ((commsfile==nullptr && !adaptivecomms) || nelim<=0) {
             cout << "keywords> error: kPS algorithm not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (traj_method==3) { // MCAMC algorithm
-        if (branchprobs || noloop) {
+        if (branchprobs || noloop || commsfile==nullptr || adaptivecomms) {
             cout << "keywords> error: MCAMC algorithm not specified correctly" << endl; exit(EXIT_FAILURE); }
     }
 }
@@ -42,6 +42,7 @@ struct Keywords {
         if (commstargfile) delete[] commstargfile;
         if (binsfile) delete[] binsfile;
         if (ntrajsfile) delete[] ntrajsfile;
+        if (ffsorderfile) delete[] ffsorderfile;
     }
 
     /* main keywords (see documentation). Here, -1 represents a value that must be set if the parameter is mandatory given
@@ -60,14 +61,22 @@ struct Keywords {
     char *commsfile=nullptr;  // "COMMSFILE" name of file where communities are defined
     int ncomms=-1;            // "COMMSFILE" number of communities on the network, eg no. of communities for resampling (WE-kMC) or trapping basins (kPS)
     bool dumpintvls=false;    // "DUMPINTVLS" trajectory data is dumped at fixed time intervals
+    int nfingerprints=0;      // "FINGERPRINT" number of most frequently observed distinct A<-B paths to write to file (WRAPPER BTOA)
+    bool fingerprintcomms=false; // (optional second argument "COMMS" to "FINGERPRINT") paths are identified by their sequences of communities
     char *initcondfile=nullptr; // "INITCOND" name of file where nonequilibrium initial probs of nodes in B are specified
     int maxit=numeric_limits<int>::max(); // "MAXIT" maximum number of iterations of the relevant standard or enhanced kMC algorithm
     int nabpaths=-1;          // "NABPATHS" target number of complete A-B paths to simulate
+    double targeterr=0.;      // "TARGETERR" target relative half-width of the 95% confidence intervals of the estimated properties, at which the
+                              //      simulation is terminated (WRAPPER BTOA, FIXEDT or DIMREDN; if >0., NABPATHS is the max. no. of paths)
+    double batcht=0.;         // (optional second argument to "TARGETERR") length in time of the batches for batch means (FIXEDT STEADYSTATE)
     double tintvl=-1.;        // "TINTVL" time interval for writing trajectory data
+    bool trajcontainer=false; // "TRAJCONTAINER" trajectory data is written to a single indexed binary file instead of to walker files
+    bool trajcompress=false;  // (optional argument "COMPRESS" to "TRAJCONTAINER") records in the container are delta/varint compressed
 
     // optional keywords pertaining to enhanced sampling methods
-    bool adaptivecomms=false; // "ADAPTIVECOMMS" communities for resampling (WE-kMC) or trapping basins (kPS) are determined on-the-fly
+    bool adaptivecomms=false; // "ADAPTIVECOMMS" communities for trapping basins (kPS) are determined on-the-fly
     double adaptminrate=0.;   // "ADAPTIVECOMMS" minimum transition rate to include in the BFS procedure to define a community on-the-fly
+    vector<double> cglagtimes; // "CGLAGTIMES" lag times at which coarse-grained transition matrices are estimated on-the-fly (DIMREDN)
     char *commstargfile=nullptr; // "COMMSTARGFILE" name of file where target number of trajectories in each community is defined (WE-kMC)
     char *ntrajsfile=nullptr; // "DIMREDUCTION" name of file where number of short trajectories to be ran from each community are defined
     int kpskmcsteps=0;        // "KPSKMCSTEPS" number of BKL kMC steps after a trapping basin escape (kPS or MCAMC)
@@ -75,23 +84,35 @@ struct Keywords {
     int nelim=-1;             // "NELIM" maximum number of states to be eliminated from any trapping basin (kPS)
     int nwalkers=-1;          // "NWALKERS" for certain enhanced sampling (WRAPPER) methods, number of independent trajectories on the network. For
                               //      certain other enhanced sampling methods, this parameter is ignored and overriden to a default value
+    double deltastep=-1.;     // "DELTASTEP" (optional argument) bucket width in the Delta-stepping algorithm to compute the shortest path tree in
+                              //      the REA (if >=0., the parallel Delta-stepping algorithm is used instead of Dijkstra's algorithm)
     bool reanotirred=false;   // "REANOTIRRED" prevents throwing of errors when a candidate path cannot be found in the REA (expected behaviour for
                               //      reducible, but not irreducible, Markov chains)
     bool steadystate=false;   // "STEADYSTATE" indicates that a small number of trajectories are to be used to estimate steady state dynamical properties
     double ssrec=0.;          // "STEADYSTATE" time interval after which the trajectory is considered to be equilibriated and recording of steady state
                               //      A<-B transition path ensemble statistics begins
-    double taure=0.;          // "TAURE" time between resampling ensemble of trajectories (WE)
+    double taure=0.;          // "TAURE" time between resampling ensemble of trajectories (WE) or updating window weights (NEUS)
+    int ffstrials=-1;         // "FFSTRIALS" number of trial trajectories fired from each interface (FFS)
+    char *ffsorderfile=nullptr; // "FFSORDERFILE" name of file where the value of the order parameter for each node is defined (FFS)
+    vector<double> ffsinterfaces; // "FFSINTERFACES" values of the order parameter at the interfaces (FFS)
+    double ffsprune=0.;       // "FFSPRUNE" probability of pruning a trial trajectory that falls back across an earlier interface (FFS)
     long double trajt=0.;     // "TRAJT" max time for trajectories (when simulating trajectories of fixed total time)
-    bool writerea=false;      // "WRITEREA" if WRAPPER REA, write trajectory data for the k shortest paths to output files
+    bool writerea=false;      // "WRITEREA" if WRAPPER REA or EPPSTEIN, write trajectory data for the k shortest paths to output files
 
     // keywords for state reduction methods
     bool absorption=false;    // "ABSORPTION" specifies that an absorption probability calculation is to be performed
     bool committor=false;     // "COMMITTOR" specifies that a committor probability calculation is to be performed instead of a kPS simulation
     bool fundamentalirred=false; // "FUNDAMENTALIRRED" specifies that the fundamental matrix of an irreducible Markov chain is to be computed
     bool fundamentalred=false; // "FUNDAMENTALRED" specifies that the fundamental matrix of an absorbing (reducible) Markov chain is to be computed
+    int fundblocksz=32;       // "FUNDBLOCKSZ" number of target nodes per block in the blocked computation of the fundamental matrix
+    bool fundstream=false;    // "FUNDSTREAM" write the elements of the fundamental matrix as they are computed, instead of storing the dense matrix
+    bool fptmoments=false;    // "FPTMOMENTS" when used with MFPT, the second and third moments of the first passage time distribution are also computed
     bool gth=false;           // "GTH" specifies that the Grassmann-Taksar-Heyman algorithm for computation of the stationary distribution is to be performed
+    double memlimit=-1.;      // "MEMLIMIT" max. memory (MB) for the active network in an out-of-core state reduction computation (if >0.)
+    char *scratchfile=nullptr; // (optional second argument to "MEMLIMIT") name of the scratch file for the out-of-core computation
     bool mfpt=false;          // "MFPT" specifies that the MFPTs for transitions from all non-target nodes are to be computed
     bool pathlengths=false;   // "PATHLENGTHS" specifies that mean first passage path lengths (instead of times) are calculated
+    bool tpt=false;           // "TPT" when used with COMMITTOR, the reactive fluxes and rate of transition path theory are also computed
 
     // other keywords
     bool accumprobs=false;    // "ACCUMPROBS" if simulating walkers using the BKL algorithm, optimize efficiency by ordering edges by transition probs
@@ -99,6 +120,8 @@ struct Keywords {
     bool debug=false;         // "DEBUG" turn on extra print statements to aid debugging
     bool discretetime=false;  // "DISCRETETIME" edge weights are read in as transition probabilities (instead of log transition rates). The provided
                               //                edge weights therefore represent a discrete-time Markov chain (DTMC) at lag time tau
+    int asyncio=0;            // "ASYNCIO" trajectory output is formatted and written by a separate thread, fed by ring buffers of records (the
+                              //      optional argument is the capacity of the ring buffer for each simulation thread; if 0, output is synchronous)
     bool dumpwaittimes=false; // "DUMPWAITTIMES" print waiting times for nodes to file "meanwaitingtimes.dat"
     bool noloop=false;        // "NOLOOP" (for a DTMC) renormalize lag times for nodes and outgoing transition probabilities to subsume self-loops
     int nthreads=omp_get_max_threads(); // number of threads to use in parallel calculations
@@ -26,50 +26,269 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <chrono>
 
 using namespace std;
 
 Walker::~Walker() {}
 
-/* write trajectory data to walker file */
+/* set up the buffer for a walker file, either for a new path (the file is truncated) or to append to the file */
+Buffered_ofstream::Buffered_ofstream(const string &fname, bool newpath, int walker_id, int path_no) {
+    this->fname=fname; this->trunc=newpath; this->walker_id=walker_id; this->path_no=path_no;
+    f.setf(ios::right,ios::adjustfield); f.setf(ios::scientific,ios::floatfield);
+    f.precision(10);
+}
+
+Buffered_ofstream::~Buffered_ofstream() {
+    write_buf();
+}
+
+void Buffered_ofstream::end_record() {
+    if (static_cast<size_t>(f.tellp())>=buf_size) write_buf();
+}
+
+void Buffered_ofstream::write_buf() {
+    string buf=f.str();
+    if (buf.empty() && !trunc) return;
+    ofstream out_f(fname,trunc?ios_base::trunc:ios_base::app);
+    if (!out_f.is_open()) {
+        cout << "kmc_methods> error: could not open walker file " << fname << endl; exit(EXIT_FAILURE); }
+    out_f.write(buf.data(),buf.size());
+    if (!out_f) {
+        cout << "kmc_methods> error: could not write to walker file " << fname << endl; exit(EXIT_FAILURE); }
+    trunc=false; f.str("");
+}
+
+/* write trajectory data to walker file. The data is buffered between calls, until the buffer is full, the walker is reset, or a new
+   path is started */
 void Walker::dump_walker_info(bool newpath, long double time, const Node *the_node, bool intvl) {
     if (curr_node==nullptr) throw exception();
-    ofstream walker_f;
-    string walker_fname="walker."+to_string(this->walker_id)+"."+to_string(this->path_no)+".dat";
-    if (!newpath) { walker_f.open(walker_fname,ios_base::app);
-    } else { walker_f.open(walker_fname,ios_base::trunc); }
-    walker_f.setf(ios::right,ios::adjustfield); walker_f.setf(ios::scientific,ios::floatfield); // walker_f.fill('x');
-    walker_f.precision(10); // walker_f.width(18);
-    walker_f << setw(7) << the_node->node_id << setw(7) << the_node->comm_id;
-    walker_f << setw(25) << time << setw(30) << k;
-    if (!intvl) walker_f << setw(25) << p << setw(25) << s; // when printing walker info at current walker time, also print path prob and entropy flow
-    walker_f << endl;
+    if (Traj_container::active!=nullptr) {
+        if (newpath || traj_chunk==nullptr || traj_chunk->walker_id!=walker_id || traj_chunk->path_no!=path_no) {
+            traj_chunk.reset(); // write the records of the previous path before a new block is started
+            traj_chunk = make_shared<Traj_container_chunk>(walker_id,path_no,newpath);
+        }
+        traj_chunk->add_record({node_id:the_node->node_id,comm_id:the_node->comm_id,intvl:intvl,k:k,t:static_cast<double>(time), \
+            p:static_cast<double>(p),s:static_cast<double>(s)});
+        return;
+    }
+    if (Async_writer::active!=nullptr) {
+        Async_writer::active->push({type:Traj_record::walker_info,newpath:newpath,intvl:intvl,seq:0,walker_id:walker_id,path_no:path_no, \
+            node_id:the_node->node_id,comm_id:the_node->comm_id,k:k,t:time,p:p,s:s});
+        return;
+    }
+    if (newpath || walker_f==nullptr || walker_f->walker_id!=walker_id || walker_f->path_no!=path_no) {
+        walker_f.reset(); // write the buffer of the previous walker file before it is reopened
+        string walker_fname="walker."+to_string(this->walker_id)+"."+to_string(this->path_no)+".dat";
+        walker_f = make_shared<Buffered_ofstream>(walker_fname,newpath,walker_id,path_no);
+    }
+    ostringstream &walker_fs=walker_f->f;
+    walker_fs << setw(7) << the_node->node_id << setw(7) << the_node->comm_id;
+    walker_fs << setw(25) << time << setw(30) << k;
+    if (!intvl) walker_fs << setw(25) << p << setw(25) << s; // when printing walker info at current walker time, also print path prob and entropy flow
+    walker_fs << "\n";
+    walker_f->end_record();
 }
 
 /* append first passage path properties to file */
 void Walker::dump_fpp_properties() {
-    ofstream pathprops_f;
-    pathprops_f.open("fpp_properties.dat",ios_base::app);
-    pathprops_f.setf(ios::right,ios::adjustfield); pathprops_f.setf(ios::scientific,ios::floatfield);
-    pathprops_f.precision(10);
-    pathprops_f << setw(14) << path_no <<  setw(25) << t << setw(30) << k << setw(25) << p << setw(25) << s << endl;
+    if (Async_writer::active!=nullptr) {
+        Async_writer::active->push({type:Traj_record::fpp_properties,newpath:false,intvl:false,seq:0,walker_id:walker_id,path_no:path_no, \
+            node_id:0,comm_id:0,k:k,t:t,p:p,s:s});
+        return;
+    }
+    char record[160];
+    int len=snprintf(record,sizeof(record),"%14d%25.10Le%30llu%25.10Le%25.10Le\n",path_no,t,k,p,s);
+    Shared_writer::fpp_writer().write(record,static_cast<size_t>(len));
+}
+
+Shared_writer::Shared_writer(const string &fname) {
+    this->fname=fname;
+    omp_init_lock(&lock);
+}
+
+Shared_writer::~Shared_writer() {
+    omp_destroy_lock(&lock);
+}
+
+void Shared_writer::write(const char *record, size_t len) {
+    omp_set_lock(&lock);
+    if (!out_f.is_open()) {
+        out_f.open(fname,ios_base::app);
+        if (!out_f.is_open()) {
+            cout << "kmc_methods> error: could not open file " << fname << endl; exit(EXIT_FAILURE); }
+    }
+    out_f.write(record,len);
+    out_f.flush();
+    omp_unset_lock(&lock);
+}
+
+Shared_writer &Shared_writer::fpp_writer() {
+    static Shared_writer fpp_f("fpp_properties.dat");
+    return fpp_f;
+}
+
+SPSC_ring::SPSC_ring(size_t capacity) : head(0), tail(0) {
+    size_t size=1;
+    while (size<capacity) size<<=1;
+    slots.resize(size); mask=size-1;
+}
+
+/* enqueue a record, waiting (with exponential backoff) while the ring is full */
+bool SPSC_ring::push(const Traj_record &record) {
+    size_t pos=tail.load(memory_order_relaxed);
+    bool waited=false; int backoff=1;
+    while (pos-head.load(memory_order_acquire)>mask) {
+        waited=true;
+        this_thread::sleep_for(chrono::microseconds(backoff));
+        if (backoff<1024) backoff*=2;
+    }
+    slots[pos&mask]=record;
+    tail.store(pos+1,memory_order_release);
+    return !waited;
+}
+
+/* the record at the head of the ring, which remains in the ring until it is popped */
+const Traj_record *SPSC_ring::front() {
+    size_t pos=head.load(memory_order_relaxed);
+    if (pos==tail.load(memory_order_acquire)) return nullptr;
+    return &slots[pos&mask];
+}
+
+void SPSC_ring::pop() {
+    head.store(head.load(memory_order_relaxed)+1,memory_order_release);
+}
+
+Async_writer *Async_writer::active=nullptr;
+
+Async_writer::Async_writer(int nproducers, size_t capacity) : stop(false), n_stalls(0), next_seq(0) {
+    cout << "asyncio> trajectory output is written by a separate thread, with ring buffers of " << capacity \
+         << " records for each of " << nproducers << " threads" << endl;
+    for (int i=0;i<nproducers;i++) rings.push_back(unique_ptr<SPSC_ring>(new SPSC_ring(capacity)));
+    writer_thread=thread(&Async_writer::run,this);
+}
+
+Async_writer::~Async_writer() {
+    stop.store(true,memory_order_release);
+    writer_thread.join();
+    cout << "asyncio> writer thread finished, simulation threads waited for full ring buffers " << n_stalls << " times" << endl;
+}
+
+void Async_writer::push(const Traj_record &record) {
+    size_t tid=omp_get_thread_num();
+    if (tid>=rings.size()) throw exception(); // there is a ring for each of the (max. no. of) simulation threads
+    Traj_record seq_record=record;
+    seq_record.seq=next_seq.fetch_add(1,memory_order_relaxed);
+    if (!rings[tid]->push(seq_record)) n_stalls++;
+}
+
+/* main loop of the writer thread, which repeatedly writes the record with the lowest sequence number at the heads of the rings,
+   until the writer is stopped and all rings are empty. A walker is only propagated by a different thread after a synchronisation
+   point, so all of the earlier records for the walker have then been enqueued, and the records for each walker are written in order */
+void Async_writer::run() {
+    for (;;) {
+        bool stopping=stop.load(memory_order_acquire); // all records have been enqueued if the writer is being stopped
+        SPSC_ring *next_ring=nullptr;
+        const Traj_record *next_record=nullptr;
+        for (unique_ptr<SPSC_ring> &ring: rings) {
+            const Traj_record *record=ring->front();
+            if (record!=nullptr && (next_record==nullptr || record->seq<next_record->seq)) {
+                next_ring=ring.get(); next_record=record; }
+        }
+        if (next_record!=nullptr) {
+            write_record(*next_record);
+            next_ring->pop();
+        } else {
+            if (stopping) break;
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
+    }
+    walker_files.clear();
+    if (fpp_f.is_open()) fpp_f.close();
+}
+
+/* format a record and write it to the appropriate file, in the same format as Walker::dump_walker_info() and
+   Walker::dump_fpp_properties() */
+void Async_writer::write_record(const Traj_record &record) {
+    long long int key=(static_cast<long long int>(record.walker_id)<<32)|static_cast<unsigned int>(record.path_no);
+    if (record.type==Traj_record::walker_info) {
+        unordered_map<long long int,unique_ptr<Buffered_ofstream>>::iterator it_file=walker_files.find(key);
+        if (record.newpath || it_file==walker_files.end()) {
+            if (it_file!=walker_files.end()) walker_files.erase(it_file);
+            string walker_fname="walker."+to_string(record.walker_id)+"."+to_string(record.path_no)+".dat";
+            it_file=walker_files.emplace(key,unique_ptr<Buffered_ofstream>(new Buffered_ofstream(walker_fname,record.newpath, \
+                record.walker_id,record.path_no))).first;
+        }
+        ostringstream &walker_fs=it_file->second->f;
+        walker_fs << setw(7) << record.node_id << setw(7) << record.comm_id;
+        walker_fs << setw(25) << record.t << setw(30) << record.k;
+        if (!record.intvl) walker_fs << setw(25) << record.p << setw(25) << record.s;
+        walker_fs << "\n";
+        it_file->second->end_record();
+    } else if (record.type==Traj_record::fpp_properties) {
+        if (!fpp_f.is_open()) {
+            fpp_f.open("fpp_properties.dat",ios_base::app);
+            if (!fpp_f.is_open()) {
+                cout << "asyncio> error: could not open file fpp_properties.dat" << endl; exit(EXIT_FAILURE); }
+        }
+        char line[160];
+        int len=snprintf(line,sizeof(line),"%14d%25.10Le%30llu%25.10Le%25.10Le\n",record.path_no,record.t,record.k,record.p,record.s);
+        fpp_f.write(line,len);
+        fpp_f.flush(); // the record for each completed path is written immediately
+    } else { // the walker has been reset, close the walker file for the completed path
+        walker_files.erase(key);
+    }
 }
 
 /* reset path quantities */
 void Walker::reset_walker_info() {
     k=0; t=0.L; p=-numeric_limits<long double>::infinity(); s=0.L;
     prev_node=nullptr; curr_node=nullptr;
+    fingerprint=14695981039346656037ULL; fingerprint_seq.clear();
+    walker_f.reset(); // close the walker file for the completed path
+    traj_chunk.reset();
+    if (Async_writer::active!=nullptr) {
+        Async_writer::active->push({type:Traj_record::close_walker,newpath:false,intvl:false,seq:0,walker_id:walker_id,path_no:path_no, \
+            node_id:0,comm_id:0,k:0,t:0.L,p:0.L,s:0.L});
+    }
+}
+
+/* incorporate a node visited along the trajectory into the path fingerprint, which is the FNV-1a hash of the sequence of
+   visited nodes (or of their communities). Consecutive repeats (i.e. self-loop transitions, or transitions within a community)
+   are not recorded */
+void Walker::update_fingerprint(const Node *node) {
+    if (fingerprint_mode==0) return;
+    int id=(fingerprint_mode==1)?node->node_id:node->comm_id;
+    if (!fingerprint_seq.empty() && fingerprint_seq.back()==id) return;
+    fingerprint_seq.push_back(id);
+    fingerprint=(fingerprint^static_cast<unsigned long long int>(id))*1099511628211ULL;
+}
+
+/* record that a bin has been visited along the current path */
+void Walker::visit_bin(int bin_id) {
+    if (visited[bin_id]) return;
+    visited[bin_id]=true;
+    visited_bins.push_back(bin_id);
+}
+
+/* reset the record of visited bins, at a cost proportional to the number of bins visited along the path */
+void Walker::clear_visited() {
+    for (int bin_id: visited_bins) visited[bin_id]=false;
+    visited_bins.clear();
 }
 
 /* set members of the base class for methods to deal with the set of walkers (independent trajectories) */
 Wrapper_Method::Wrapper_Method(const Wrapper_args &wrapper_args) {
     this->nabpaths=wrapper_args.nabpaths; this->tintvl=wrapper_args.tintvl;
     this->maxit=wrapper_args.maxit; this->adaptivecomms=wrapper_args.adaptivecomms;
-    this->seed=wrapper_args.seed; this->debug=wrapper_args.debug;
+    this->seed=wrapper_args.seed; this->debug=wrapper_args.debug; this->targeterr=wrapper_args.targeterr;
     if (wrapper_args.nwalkers==0) return; // nwalkers=0 for REA, where walkers, visitations, committors etc vectors are not used
     walkers.resize(wrapper_args.nwalkers);
     for (int i=0;i<wrapper_args.nwalkers;i++) {
         walkers[i] = {walker_id:0,path_no:i,k:0,t:0.L,p:-numeric_limits<double>::infinity(),s:0.L};
+        if (wrapper_args.nfingerprints>0) walkers[i].fingerprint_mode=wrapper_args.fingerprintcomms?2:1;
         walkers[i].visited.resize(wrapper_args.nbins);
         fill(walkers[i].visited.begin(),walkers[i].visited.end(),false);
     }
@@ -134,10 +353,34 @@ const Node *Wrapper_Method::get_initial_node(const Network &ktn, Walker &walker,
     walker.curr_node=&(*node_b);
     walker.prev_node=walker.curr_node;
     walker.p=-1.L*(node_b->pi-pi_B); // factor in path probability corresponding to initial occupation of node
-    if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visited[node_b->bin_id]=true;
+    walker.update_fingerprint(node_b);
+    if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visit_bin(node_b->bin_id);
     return node_b;
 }
 
+/* costs (i.e. negative log initial occupation probabilities) of the virtual transitions from a super-source to all nodes in the
+   initial set B, used in the k shortest paths algorithms. The initial occupation probabilities are the specified initial
+   condition, if set, or otherwise are proportional to the stationary probabilities. The costs are infinite for nodes not in B */
+vector<double> Wrapper_Method::get_source_costs(const Network &ktn) {
+    vector<double> source_costs(ktn.n_nodes,numeric_limits<double>::infinity());
+    if (ktn.nodesB.size()==1) { // the single source node is occupied with unit probability
+        source_costs[(*ktn.nodesB.begin())->node_id-1]=0.;
+        return source_costs;
+    }
+    long double pi_B = -numeric_limits<long double>::infinity(); // (log) occupation probability of all nodes in B
+    for (const Node *node_b: ktn.nodesB) pi_B = log(exp(pi_B)+exp(node_b->pi));
+    int i=0;
+    for (const Node *node_b: ktn.nodesB) {
+        if (ktn.initcond) {
+            if (ktn.init_probs[i]>0.) source_costs[node_b->node_id-1]=-log(ktn.init_probs[i]);
+        } else {
+            source_costs[node_b->node_id-1]=static_cast<double>(pi_B-node_b->pi);
+        }
+        i++;
+    }
+    return source_costs;
+}
+
 /* function to set the Traj_Method member function to propagate individual trajectories */
 void Wrapper_Method::set_standard_kmc(void(*kmcfuncptr)(Walker&)) {
     kmc_func = kmcfuncptr;
@@ -179,15 +422,188 @@ vector<int> Wrapper_Method::find_comm_onthefly(const Network &ktn, const Node *i
 void Wrapper_Method::update_tp_stats(Walker &walker, bool abpath, bool update) {
     n_traj++; if (abpath) n_ab++;
     if (!update) return;
-    int i=0; // bin ID
-    for (bool bin_visit: walker.visited) {
-        if (bin_visit) {
-            if (abpath) { ab_successes[i]++;
-            } else { ab_failures[i]++; }
+    for (int i: walker.visited_bins) { // bin IDs
+        if (abpath) { ab_successes[i]++;
+        } else { ab_failures[i]++; }
+    }
+    walker.clear_visited();
+}
+
+thread_local default_random_engine *Task_rng::task_generator=nullptr;
+
+Task_rng::Task_rng(int seed, int task_id1, int task_id2) {
+    seed_seq task_seed{seed,task_id1,task_id2};
+    generator.seed(task_seed);
+    task_generator=&generator;
+}
+
+Task_rng::~Task_rng() { task_generator=nullptr; }
+
+default_random_engine &Task_rng::get_generator(default_random_engine &shared_generator) {
+    return task_generator!=nullptr?*task_generator:shared_generator;
+}
+
+/* initially, each thread is assigned a contiguous block of path IDs */
+Path_scheduler::Path_scheduler(int npaths, int nthreads) : deques(nthreads), n_steals(0) {
+    for (int i=0;i<nthreads;i++) {
+        for (int pathno=(i*static_cast<long long int>(npaths))/nthreads;pathno<((i+1)*static_cast<long long int>(npaths))/nthreads;pathno++) {
+            deques[i].paths.push_back(pathno); }
+        omp_init_lock(&deques[i].lock);
+    }
+}
+
+Path_scheduler::~Path_scheduler() {
+    for (Path_deque &path_deque: deques) omp_destroy_lock(&path_deque.lock);
+}
+
+bool Path_scheduler::next_path(int tid, int &pathno) {
+    Path_deque &own=deques[tid];
+    omp_set_lock(&own.lock);
+    bool found=!own.paths.empty();
+    if (found) { pathno=own.paths.front(); own.paths.pop_front(); }
+    omp_unset_lock(&own.lock);
+    if (found) return true;
+    // steal from the other threads in turn. No paths are added after construction, so there are none left if all deques are empty
+    for (int i=1;i<static_cast<int>(deques.size());i++) {
+        Path_deque &victim=deques[(tid+i)%deques.size()];
+        omp_set_lock(&victim.lock);
+        found=!victim.paths.empty();
+        if (found) { pathno=victim.paths.back(); victim.paths.pop_back(); }
+        omp_unset_lock(&victim.lock);
+        if (found) { n_steals++; return true; }
+    }
+    return false;
+}
+
+void Tp_stats_accumulator::init(int nbins) {
+    n_ab=0; n_traj=0; sparse=nbins>max_dense_bins;
+    fpt_stats=Running_stats(); len_stats=Running_stats();
+    if (!sparse && nbins>0) { ab_successes.assign(nbins,0); ab_failures.assign(nbins,0); }
+    touched_bins.clear(); sparse_counts.clear();
+}
+
+void Tp_stats_accumulator::clear() {
+    n_ab=0; n_traj=0;
+    fpt_stats=Running_stats(); len_stats=Running_stats();
+    for (int i: touched_bins) { ab_successes[i]=0; ab_failures[i]=0; }
+    touched_bins.clear(); sparse_counts.clear();
+}
+
+/* increment the thread-private counts of A<-B and B<-B paths and, if desired, of bin appearances along the path */
+void Tp_stats_accumulator::update(Walker &walker, bool abpath, bool update) {
+    n_traj++;
+    if (abpath) { n_ab++; fpt_stats.update(walker.t); len_stats.update(walker.k); }
+    if (!update) return;
+    for (int i: walker.visited_bins) {
+        if (sparse) { if (abpath) { sparse_counts[i].first++; } else { sparse_counts[i].second++; }
+            continue; }
+        if (ab_successes[i]==0 && ab_failures[i]==0) touched_bins.push_back(i);
+        if (abpath) { ab_successes[i]++;
+        } else { ab_failures[i]++; }
+    }
+    walker.clear_visited();
+}
+
+void Wrapper_Method::merge_tp_stats(const Tp_stats_accumulator &accum) {
+    n_ab+=accum.n_ab; n_traj+=accum.n_traj;
+    fpt_stats.merge(accum.fpt_stats); len_stats.merge(accum.len_stats);
+    if (accum.sparse) {
+        for (const pair<const int,pair<int,int>> &counts: accum.sparse_counts) {
+            ab_successes[counts.first]+=counts.second.first; ab_failures[counts.first]+=counts.second.second; }
+    } else {
+        for (int i: accum.touched_bins) {
+            ab_successes[i]+=accum.ab_successes[i]; ab_failures[i]+=accum.ab_failures[i]; }
+    }
+}
+
+void Running_stats::update(long double x) {
+    n++;
+    long double delta=x-mean;
+    mean+=delta/static_cast<long double>(n);
+    m2+=delta*(x-mean);
+}
+
+void Running_stats::merge(const Running_stats &other) {
+    if (other.n==0) return;
+    long long int n_tot=n+other.n;
+    long double delta=other.mean-mean;
+    mean+=delta*static_cast<long double>(other.n)/static_cast<long double>(n_tot);
+    m2+=other.m2+delta*delta*static_cast<long double>(n)*static_cast<long double>(other.n)/static_cast<long double>(n_tot);
+    n=n_tot;
+}
+
+/* the confidence interval is based on the normal approximation for the distribution of the sample mean */
+long double Running_stats::half_width() const {
+    if (n<2) return numeric_limits<long double>::infinity();
+    return 1.96L*sqrt(m2/static_cast<long double>((n-1)*n));
+}
+
+long double Running_stats::rel_err() const {
+    if (mean==0.L) return numeric_limits<long double>::infinity();
+    return half_width()/fabs(mean);
+}
+
+void Batch_means::init(long double t_start, long double batcht) {
+    this->batcht=batcht; t_end=t_start+batcht; sum=0.L; batches=Running_stats();
+}
+
+/* batches that end before the time of the observation are closed (including batches in which there are no observations) */
+void Batch_means::update(long double t, long double val) {
+    while (t>t_end) { batches.update(sum/batcht); sum=0.L; t_end+=batcht; }
+    sum+=val;
+}
+
+/* a batch that ends at (to within a small tolerance, for the last batch of the recording period) or before the time at which the
+   trajectory terminates is complete. The observations of an incomplete batch at the end of the trajectory are discarded */
+void Batch_means::close(long double t) {
+    while (t_end<=t+1.E-09L*batcht) { batches.update(sum/batcht); sum=0.L; t_end+=batcht; }
+}
+
+/* the simulation of A<-B paths is considered to be converged when the 95% confidence intervals for the mean first passage time
+   and for the mean path length have relative half-widths not exceeding the target, and when the confidence intervals for the
+   committor probabilities of bins have half-widths not exceeding the target (committor probabilities lie in [0,1], so that the
+   absolute half-width is used). The confidence intervals for the committors are based on the binomial distribution, with the
+   add-two-successes-and-two-failures estimate of the probability. Only bins visited along at least a minimum fraction of all
+   paths are tested, since rarely visited bins continue to be discovered as the sampling grows, and their confidence intervals
+   are necessarily wide */
+bool Wrapper_Method::check_convergence(int nbins) const {
+    if (fpt_stats.n<min_conv_samples || fpt_stats.rel_err()>targeterr || len_stats.rel_err()>targeterr) return false;
+    if (adaptivecomms) return true;
+    long double min_n=max(1.L,static_cast<long double>(min_conv_bin_frac)*static_cast<long double>(n_traj));
+    for (int i=0;i<nbins;i++) {
+        long double n=ab_successes[i]+ab_failures[i];
+        if (n<min_n) continue;
+        long double q=(ab_successes[i]+2.L)/(n+4.L);
+        if (1.96L*sqrt(q*(1.L-q)/(n+4.L))>targeterr) return false;
+    }
+    return true;
+}
+
+void Wrapper_Method::print_estimate(const string &prefix, const string &name, const Running_stats &stats) {
+    cout << prefix << "> " << name << ": " << stats.mean << " +/- " << stats.half_width() << "   (relative error: " \
+         << stats.rel_err() << "   no. of samples: " << stats.n << ")" << endl;
+}
+
+/* convergence report for A<-B paths: estimates with half-widths of 95% confidence intervals, and the bin with the widest confidence
+   interval for the committor probability */
+void Wrapper_Method::write_conv_report(int nbins) const {
+    cout << "wrapper_method> convergence report for A<-B paths (95% confidence intervals):" << endl;
+    print_estimate("wrapper_method","A<-B MFPT",fpt_stats);
+    print_estimate("wrapper_method","mean A<-B path length",len_stats);
+    if (nbins>0 && !adaptivecomms) {
+        int worst_bin=-1; long double max_hw=0.L;
+        long double min_n=max(1.L,static_cast<long double>(min_conv_bin_frac)*static_cast<long double>(n_traj));
+        for (int i=0;i<nbins;i++) { // only bins that are tested for convergence are considered
+            long double n=ab_successes[i]+ab_failures[i];
+            if (n<min_n) continue;
+            long double q=(ab_successes[i]+2.L)/(n+4.L), hw=1.96L*sqrt(q*(1.L-q)/(n+4.L));
+            if (hw>max_hw) { max_hw=hw; worst_bin=i; }
         }
-        i++;
+        if (worst_bin>=0) cout << "wrapper_method> max. half-width for bin committor probabilities: " << max_hw << "   (bin " \
+                           << worst_bin << ", visited along " << ab_successes[worst_bin]+ab_failures[worst_bin] << " paths)" << endl;
     }
-    fill(walker.visited.begin(),walker.visited.end(),false);
+    if (targeterr>0.) cout << "wrapper_method> target relative error " << targeterr << (check_convergence(nbins)?" was":" was not") \
+                      << " reached" << endl;
 }
 
 /* calculate the transition path statistics for bins from the observed counts during the simulation */
@@ -215,47 +631,108 @@ void Wrapper_Method::write_tp_stats(int nbins) {
 /* draw a uniform random number between 0 and 1, used in Metropolis conditions etc. */
 long double Wrapper_Method::rand_unif_met(int seed) {
     static default_random_engine generator(seed);
-    static uniform_real_distribution<long double> unif_real_distrib(0.L,1.L);
-    return unif_real_distrib(generator);
+    uniform_real_distribution<long double> unif_real_distrib(0.L,1.L);
+    return unif_real_distrib(Task_rng::get_generator(generator));
+}
+
+/* sample a node from a cumulative distribution (which is not normalised), given as pairs of node positions and accumulated
+   probabilities */
+int Wrapper_Method::sample_cum_distribn(const vector<pair<int,long double>> &probs, int seed) {
+    long double rand_no=rand_unif_met(seed)*probs.back().second;
+    vector<pair<int,long double>>::const_iterator it_probs = upper_bound(probs.begin(),probs.end(),rand_no, \
+        [](long double val, const pair<int,long double> &prob) { return val<prob.second; });
+    if (it_probs==probs.end()) --it_probs;
+    return it_probs->first;
+}
+
+/* stationary distribution (not normalised) of a small Markov chain with dense transition probability matrix, computed by the
+   Grassmann-Taksar-Heyman (GTH) algorithm, which does not involve subtraction and is therefore numerically stable */
+vector<long double> Wrapper_Method::calc_stat_distribn(vector<vector<long double>> tmtx) {
+    int m=tmtx.size();
+    for (int n=m-1;n>0;n--) {
+        long double s=0.L;
+        for (int j=0;j<n;j++) s+=tmtx[n][j];
+        if (s==0.L) continue;
+        for (int i=0;i<n;i++) tmtx[i][n]/=s;
+        for (int i=0;i<n;i++) {
+            if (tmtx[i][n]==0.L) continue;
+            for (int j=0;j<n;j++) tmtx[i][j]+=tmtx[i][n]*tmtx[n][j];
+        }
+    }
+    vector<long double> stat_probs(m,0.L);
+    if (m>0) stat_probs[0]=1.L;
+    for (int n=1;n<m;n++) {
+        for (int i=0;i<n;i++) stat_probs[n]+=stat_probs[i]*tmtx[i][n]; }
+    return stat_probs;
 }
 
 /* Wrapper_Method corresponding to simulation of A<-B paths (using chosen trajectory propagation method) with no enhanced sampling method */
 BTOA::BTOA(const Network &ktn, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
     cout << "btoa> setting up simulation of A<-B paths with no enhanced sampling method" << endl;
+    nfingerprints=wrapper_args.nfingerprints;
+    if (nfingerprints>0) {
+        cout << "btoa> A<-B paths are fingerprinted by their sequences of visited " \
+             << (wrapper_args.fingerprintcomms?"communities":"nodes") << endl;
+        fingerprint_counts.resize(n_fp_shards); fingerprint_locks.resize(n_fp_shards);
+        for (omp_lock_t &lock: fingerprint_locks) omp_init_lock(&lock);
+    }
+    omp_init_lock(&top_fingerprints_lock);
+    top_fingerprints_min=0;
 }
 
-BTOA::~BTOA() {}
+BTOA::~BTOA() {
+    for (omp_lock_t &lock: fingerprint_locks) omp_destroy_lock(&lock);
+    omp_destroy_lock(&top_fingerprints_lock);
+}
 
 /* main loop to drive simulation of A<-B paths with no special enhanced sampling wrapper method */
 void BTOA::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
     cout << "\n\nbtoa> beginning simulation of A<-B paths with no enhanced sampling method" << endl;
-    n_ab=0; n_traj=0; int n_it=0;
-    #pragma omp parallel
+    n_ab=0; n_traj=0; atomic<int> n_it(0);
+    if (traj_method_obj->statereduction) { // state reduction computation is called outside of a parallel region, since it may itself be parallelised
+        traj_method_obj->kmc_iteration(ktn,walkers[0]);
+        cout << "\nbtoa> finished state reduction computation" << endl;
+        return;
+    }
+    /* the statistics are accumulated privately by each thread, and the shared count of iterations is updated in batches, so that
+       threads do not contend for shared cache lines after every iteration or path */
+    vector<Tp_stats_accumulator> tp_stats_accums(walkers.size());
+    /* each thread simulates its paths with its own walker, so the team of threads is no larger than the number of walkers */
+    int nthreads_sched = min(static_cast<int>(walkers.size()),omp_get_max_threads());
+    Path_scheduler path_scheduler(nabpaths,nthreads_sched);
+    int n_it_batch = max(1,min(256,maxit/(16*static_cast<int>(walkers.size())))); // max. no. of iterations not yet counted per thread
+    /* if a target relative error is set, each thread merges its statistics into the shared statistics after a fixed number of A<-B
+       paths and tests for convergence. Once converged, the threads complete their current paths and do not begin new paths */
+    const int n_conv_batch=32; // max. no. of A<-B paths not yet merged per thread
+    atomic<bool> converged(false);
+    omp_lock_t conv_lock; omp_init_lock(&conv_lock);
+    #pragma omp parallel num_threads(nthreads_sched)
     {
     int x = omp_get_thread_num();
     Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
-    #pragma omp for
-    for (int pathno=0;pathno<nabpaths;pathno++) {
+    Tp_stats_accumulator &tp_stats_accum = tp_stats_accums[x];
+    tp_stats_accum.init(adaptivecomms?0:ktn.nbins);
+    int n_it_local=0; // iterations of this thread not yet added to the shared count
+    int pathno;
+    while (!converged.load(memory_order_relaxed) && path_scheduler.next_path(x,pathno)) {
+        walkers[x].path_no=pathno; // the walker of this thread simulates the path with the ID assigned by the scheduler
         for (;;) {
-            if (n_it>maxit) break; // quack this leaves walker files that are not complete A<-B trajectories
+            if (n_it.load(memory_order_relaxed)>maxit) break; // quack this leaves walker files that are not complete A<-B trajectories
             bool donebklsteps=false;
             traj_method_local->kmc_iteration(ktn,walkers[x]);
-            if (traj_method_local->statereduction) break; // if the purpose of the computation was to perform a state reduction procedure, quit here
             traj_method_local->dump_traj(walkers[x],walkers[x].curr_node->aorb==-1,false);
-            #pragma omp atomic
-            n_it++;
+            if (++n_it_local==n_it_batch) { n_it.fetch_add(n_it_local,memory_order_relaxed); n_it_local=0; }
             check_if_endpoint:
                 if (walkers[x].curr_node->aorb==-1 || walkers[x].curr_node->aorb==1) { // traj has reached absorbing macrostate A or has returned to B
-                    #pragma omp critical
-                    update_tp_stats(walkers[x],walkers[x].curr_node->aorb==-1,!adaptivecomms);
+                    tp_stats_accum.update(walkers[x],walkers[x].curr_node->aorb==-1,!adaptivecomms);
                     if (walkers[x].curr_node->aorb==-1) { // transition path, reset walker
+                        if (nfingerprints>0) count_fingerprint(walkers[x]);
                         walkers[x].reset_walker_info();
-                        walkers[x].path_no += walkers.size();
                         traj_method_local->reset_nodeptrs();
                         break;
                     } else if (ktn.nbins>0) {
-                        walkers[x].visited[walkers[x].curr_node->bin_id]=true;
+                        walkers[x].visit_bin(walkers[x].curr_node->bin_id);
                     }
                 }
                 if (donebklsteps) continue;
@@ -263,125 +740,397 @@ void BTOA::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
             donebklsteps=true;
             goto check_if_endpoint;
         }
+        if (targeterr>0. && tp_stats_accum.n_ab>=n_conv_batch) {
+            omp_set_lock(&conv_lock);
+            merge_tp_stats(tp_stats_accum);
+            if (check_convergence(ktn.nbins)) converged.store(true,memory_order_relaxed);
+            omp_unset_lock(&conv_lock);
+            tp_stats_accum.clear();
+        }
     }
+    n_it.fetch_add(n_it_local,memory_order_relaxed);
+    delete traj_method_local;
     }
+    omp_destroy_lock(&conv_lock);
+    for (const Tp_stats_accumulator &tp_stats_accum: tp_stats_accums) merge_tp_stats(tp_stats_accum);
     cout << "\nbtoa> simulation terminated after " << n_it << " iterations. Simulated " \
          << n_ab << " transition paths" << endl;
-    if (!traj_method_obj->statereduction && !adaptivecomms) calc_tp_stats(ktn.nbins); // calc committor and visitation probs for bins and write to file
+    if (converged) cout << "btoa> simulation was terminated because the target relative error was reached" << endl;
+    if (debug) cout << "btoa> " << path_scheduler.get_n_steals() << " paths were stolen by idle threads" << endl;
+    if (n_ab>0) write_conv_report(ktn.nbins);
+    if (!adaptivecomms) calc_tp_stats(ktn.nbins); // calc committor and visitation probs for bins and write to file
+    if (nfingerprints>0) write_fingerprints();
+}
+
+/* increment the count for the distinct path that has been simulated by the walker. The hash map of path counts is divided into
+   shards, each of which has its own lock, so that threads rarely contend. Distinct paths are identified by their fingerprints only
+   (i.e. paths with colliding 64-bit hashes are not distinguished), and the sequence of the walker is moved into the set of most
+   frequent paths only if the path enters this set. The lock for this set is acquired only if the count of the path exceeds the
+   least count in the set, and the shard locks are always acquired after (never before) this lock. A path is marked as being in the
+   set, or not, while its shard lock is held, so that the test of the mark after an increment is consistent with the set */
+void BTOA::count_fingerprint(Walker &walker) {
+    unsigned long long int hash=walker.fingerprint;
+    int shard=static_cast<int>(hash%n_fp_shards);
+    omp_set_lock(&fingerprint_locks[shard]);
+    Path_fingerprint &fp=fingerprint_counts[shard][hash];
+    long long int count=++fp.count;
+    bool top=fp.top;
+    omp_unset_lock(&fingerprint_locks[shard]);
+    if (top || count<=top_fingerprints_min.load(memory_order_relaxed)) return;
+    omp_set_lock(&top_fingerprints_lock);
+    if (top_fingerprint_seqs.find(hash)==top_fingerprint_seqs.end()) {
+        auto set_top = [&](unsigned long long int fp_hash, bool fp_top) {
+            int fp_shard=static_cast<int>(fp_hash%n_fp_shards);
+            omp_set_lock(&fingerprint_locks[fp_shard]);
+            fingerprint_counts[fp_shard][fp_hash].top=fp_top;
+            omp_unset_lock(&fingerprint_locks[fp_shard]); };
+        if (static_cast<int>(top_fingerprint_seqs.size())<nfingerprints) { // set of most frequent paths is not yet full
+            top_fingerprint_seqs[hash]=move(walker.fingerprint_seq);
+            set_top(hash,true);
+        } else { // replace the least frequent path in the set, if this path is now more frequent
+            unsigned long long int min_hash=0; long long int min_count=numeric_limits<long long int>::max();
+            for (const auto &top_fp: top_fingerprint_seqs) {
+                long long int top_count=get_fingerprint_count(top_fp.first);
+                if (top_count<min_count) { min_hash=top_fp.first; min_count=top_count; }
+            }
+            count=get_fingerprint_count(hash);
+            if (count>min_count) {
+                /* the least frequent path is removed from the set only if its count, read while its shard lock is held, is still less
+                   than the count of this path. Hence a concurrent increment of its count either is accounted for here, or finds that
+                   the path is no longer in the set (and is then tested for re-entry into the set by the incrementing thread) */
+                int min_shard=static_cast<int>(min_hash%n_fp_shards);
+                omp_set_lock(&fingerprint_locks[min_shard]);
+                Path_fingerprint &min_fp=fingerprint_counts[min_shard][min_hash];
+                bool evict=count>min_fp.count;
+                if (evict) min_fp.top=false;
+                omp_unset_lock(&fingerprint_locks[min_shard]);
+                if (evict) {
+                    top_fingerprint_seqs.erase(min_hash);
+                    top_fingerprint_seqs[hash]=move(walker.fingerprint_seq); set_top(hash,true);
+                }
+            }
+        }
+        if (static_cast<int>(top_fingerprint_seqs.size())==nfingerprints) { // update the least count in the set
+            long long int min_count=numeric_limits<long long int>::max();
+            for (const auto &top_fp: top_fingerprint_seqs) min_count=min(min_count,get_fingerprint_count(top_fp.first));
+            top_fingerprints_min.store(min_count,memory_order_relaxed);
+        }
+    }
+    omp_unset_lock(&top_fingerprints_lock);
+}
+
+/* return the count of the distinct path with the given fingerprint */
+long long int BTOA::get_fingerprint_count(unsigned long long int hash) {
+    int shard=static_cast<int>(hash%n_fp_shards);
+    omp_set_lock(&fingerprint_locks[shard]);
+    long long int count=fingerprint_counts[shard][hash].count;
+    omp_unset_lock(&fingerprint_locks[shard]);
+    return count;
+}
+
+/* write the most frequently observed distinct A<-B paths, in order of decreasing count, to the file "path_fingerprints.dat".
+   Each line lists the rank, count, fraction of all A<-B paths, fingerprint, and length and sequence of nodes (or communities) */
+void BTOA::write_fingerprints() {
+    size_t n_distinct=0;
+    for (const auto &shard: fingerprint_counts) n_distinct+=shard.size();
+    vector<pair<long long int,unsigned long long int>> fp_counts;
+    for (const auto &top_fp: top_fingerprint_seqs) fp_counts.push_back(make_pair(get_fingerprint_count(top_fp.first),top_fp.first));
+    cout << "btoa> observed " << n_distinct << " distinct A<-B paths, writing the " << fp_counts.size() \
+         << " most frequent paths to file" << endl;
+    auto fp_order = [](const pair<long long int,unsigned long long int> &a, const pair<long long int,unsigned long long int> &b) {
+        if (a.first!=b.first) return a.first>b.first;
+        return a.second<b.second; };
+    sort(fp_counts.begin(),fp_counts.end(),fp_order);
+    ofstream fp_f; fp_f.open("path_fingerprints.dat");
+    for (int i=0;i<static_cast<int>(fp_counts.size());i++) {
+        const vector<int> &seq=top_fingerprint_seqs.at(fp_counts[i].second);
+        fp_f << setw(7) << i+1 << setw(14) << fp_counts[i].first << setw(20) << fixed << setprecision(12) \
+             << static_cast<double>(fp_counts[i].first)/static_cast<double>(n_ab) << setw(22) << fp_counts[i].second << setw(10) << seq.size();
+        for (int id: seq) fp_f << " " << id;
+        fp_f << endl;
+    }
 }
 
 /* Wrapper_Method corresponding to simulation of paths of fixed total time (using chosen trajectory propagation method) with no
    enhanced sampling method. By considering a single (or a small number of) very long timescale trajectories, this wrapper method
    can be used to simulate the steady state */
-FIXEDT::FIXEDT(const Network &ktn, long double trajt, bool steadystate, double ssrec, \
+FIXEDT::FIXEDT(const Network &ktn, long double trajt, bool steadystate, double ssrec, double batcht, \
            const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
     cout << "fixedt> setting up simulation of fixed time paths with no enhanced sampling method" << endl;
     this->trajt=trajt; this->steadystate=steadystate; this->ssrec=ssrec;
+    this->batcht=batcht>0.?batcht:(trajt-ssrec)/100.; // by default, the recording period of each trajectory comprises 100 batches
+    if (steadystate) cout << "fixedt> length of batches for the batch means estimate of the steady state rate of entering A: " \
+                          << this->batcht << endl;
 }
 
 FIXEDT::~FIXEDT() {}
 
-/* main loop to drive simulation of paths of fixed total time with no special enhanced sampling wrapper method */
+/* main loop to drive simulation of paths of fixed total time with no special enhanced sampling wrapper method. If the STEADYSTATE
+   keyword is set, the steady state rate of entering A is estimated by batch means along the trajectories, since the hits of A along
+   a single trajectory are correlated. If a target relative error is set, each thread merges its completed batches into the shared
+   estimator and tests for convergence, and all trajectories are then terminated at their current times */
 void FIXEDT::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
     cout << "\n\nfixedt> beginning simulation of paths of fixed time" << endl;
     int n_it=0;
     int noahits=0; // number of times that the A (target) set is hit
-    long double tot_trajt=0.L; // total time spent collecting A<-B steady state path statistics
-    bool fromb; // if true, indicates that the trajectory segment is traveling having last occupied B and not A
-    #pragma omp parallel
+    vector<long double> tot_trajts(walkers.size(),0.L); // total time spent by each thread collecting A<-B steady state path statistics
+    atomic<bool> converged(false);
+    omp_lock_t conv_lock; omp_init_lock(&conv_lock);
+    rate_stats=Running_stats();
+    /* each thread simulates its trajectories with its own walker, so the team of threads is no larger than the number of walkers
+       (which may be less than the number of threads if the STEADYSTATE keyword is not set) */
+    int nthreads_sched = min(static_cast<int>(walkers.size()),omp_get_max_threads());
+    Path_scheduler path_scheduler(nabpaths,nthreads_sched);
+    #pragma omp parallel num_threads(nthreads_sched)
     {
     int x = omp_get_thread_num();
     Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
-    #pragma omp for
-    for (int pathno=0;pathno<nabpaths;pathno++) {
+    bool fromb=false; // if true, indicates that the trajectory segment is traveling having last occupied B and not A
+    Batch_means batch_means; // batch means estimator for the rate of entering A along the trajectory of this thread
+    auto merge_batches = [&]() { // merge the completed batches into the shared estimator
+        omp_set_lock(&conv_lock);
+        rate_stats.merge(batch_means.batches);
+        if (targeterr>0. && rate_stats.n>=min_conv_samples && rate_stats.rel_err()<=targeterr) {
+            converged.store(true,memory_order_relaxed); }
+        omp_unset_lock(&conv_lock);
+        batch_means.batches=Running_stats();
+    };
+    int pathno;
+    while (!converged.load(memory_order_relaxed) && path_scheduler.next_path(x,pathno)) {
+        walkers[x].path_no=pathno; // the walker of this thread simulates the path with the ID assigned by the scheduler
 	if (steadystate && ssrec>0.) { fromb=false; // for transition path stats, only count traj segment starting from B when equilibriation time period has passed
 	} else if (ssrec>0.) { fromb=true; }
+        batch_means.init(ssrec,batcht);
         while (walkers[x].t<trajt) { // continue simulation of trajectory until desired time is reached
 	    if (n_it>maxit) break; // quack this leaves walker files that do not meet the specified fixed trajectory time
+	    if (converged.load(memory_order_relaxed)) break; // the target relative error has been reached
 	    bool donebklsteps=false;
-//	    cout << "  taking step" << endl;
             traj_method_local->kmc_iteration(ktn,walkers[x]);
 	    traj_method_local->dump_traj(walkers[x],false,false);
             #pragma omp atomic
 	    n_it++;
             check_if_endpoint: // if STEADYSTATE keyword is set, check collection of transition path bin statistics
-	        if (ktn.nbins>0 && steadystate && walkers[x].t>ssrec) { // equilibriation period has passed, bin statistics can be recorded
-//                cout << "  checking for endpoint" << endl;
-		if (walkers[x].curr_node->aorb==-1) {
+	        if (steadystate && walkers[x].t>ssrec) { // equilibriation period has passed, steady state statistics can be recorded
+		bool hit_a = walkers[x].curr_node->aorb==-1 && walkers[x].prev_node->aorb!=-1;
+		if (walkers[x].t<=trajt) batch_means.update(walkers[x].t,hit_a?1.L:0.L);
+		if (ktn.nbins>0 && walkers[x].curr_node->aorb==-1) {
 		    if (fromb) update_tp_stats(walkers[x],true,true); // trajectory segment has hit A from B; record bin statistics
-//	            if (fromb) cout << "    TRAJ PASSED FROM B TO A" << endl;
 		    fromb=false; // traj segment is now transitioning from A, not B (so bin stats should not be recorded until the traj hits B again)
-		    if (walkers[x].prev_node->aorb!=-1) { // hit A from outside A; counts towards estimate of steady-state MFPT
-	                #pragma omp atomic
-			noahits++;
-		    }
-		} else if (walkers[x].curr_node->aorb==1) { // trajectory segment is in B; reset vector of visited states
-//                    cout << "    TRAJ IN B" << endl;
+		} else if (ktn.nbins>0 && walkers[x].curr_node->aorb==1) { // trajectory segment is in B; reset vector of visited states
 		    fromb=true; // the trajectory segment is starting from B, so bin statistics should be recorded
-                    fill(walkers[x].visited.begin(),walkers[x].visited.end(),false);
-		    walkers[x].visited[walkers[x].curr_node->bin_id]=true;
+                    walkers[x].clear_visited();
+		    walkers[x].visit_bin(walkers[x].curr_node->bin_id);
 		}
+		if (hit_a) { // hit A from outside A; counts towards estimate of steady-state rate of entering A
+	            #pragma omp atomic
+		    noahits++;
+		}
+		if (batch_means.batches.n>0) merge_batches();
 		}
 		if (donebklsteps) continue;
 	    // do BKL steps
 	    if (walkers[x].t<trajt) {
-//		cout << "  doing BKL steps" << endl;
 	        traj_method_local->do_bkl_steps(ktn,walkers[x]);
 		donebklsteps=true;
 		goto check_if_endpoint;
 	    }
         }
-	tot_trajt += walkers[x].t-ssrec; // increment total time spent collecting trajectory statistics
+	if (steadystate) { // the final batch of the recording period (or any batch that has ended before an early stop) is complete
+	    batch_means.close(min(walkers[x].t,trajt));
+	    if (batch_means.batches.n>0) merge_batches();
+	}
+	tot_trajts[x] += max(0.L,min(walkers[x].t,trajt)-ssrec); // increment total time spent collecting trajectory statistics
 	// reset trajectory
 	walkers[x].reset_walker_info();
-	walkers[x].path_no += walkers.size();
-	if (ktn.nbins>0) fill(walkers[x].visited.begin(),walkers[x].visited.end(),false);
+	if (ktn.nbins>0) walkers[x].clear_visited();
 	traj_method_local->reset_nodeptrs();
     }
+    delete traj_method_local;
     }
+    omp_destroy_lock(&conv_lock);
     cout << "fixedt> simulation terminated after " << n_it << " iterations" << endl;
+    if (converged) cout << "fixedt> simulation was terminated because the target relative error was reached" << endl;
+    if (debug) cout << "fixedt> " << path_scheduler.get_n_steals() << " paths were stolen by idle threads" << endl;
     if (steadystate) {
-        long double mfptss = static_cast<double>(noahits)/tot_trajt;
-        cout << "fixedt> simulation estimate for steady-state MFPT:    " << mfptss << endl;
+        long double tot_trajt=0.L;
+        for (long double trajt_x: tot_trajts) tot_trajt+=trajt_x;
+        cout << "fixedt> simulation estimate for steady-state rate of entering A: " << static_cast<long double>(noahits)/tot_trajt \
+             << "   (inverse: " << tot_trajt/static_cast<long double>(noahits) << ")" << endl;
+        cout << "fixedt> convergence report for the steady state (95% confidence interval from batch means):" << endl;
+        print_estimate("fixedt","rate of entering A",rate_stats);
+        if (targeterr>0.) cout << "fixedt> target relative error " << targeterr << (converged?" was":" was not") << " reached" << endl;
     }
     if (ktn.nbins>0) calc_tp_stats(ktn.nbins);
 }
 
+Cg_counts::Cg_counts(int ncomms, long double tunit, long double maxtime, const vector<int> &lags) {
+    this->ncomms=ncomms; this->tunit=tunit; this->maxtime=maxtime; this->lags=lags;
+    lag_counts.resize(lags.size()); comm_times.assign(ncomms,0.L);
+    n_dwell_bins=static_cast<long long int>(maxtime/tunit)+1;
+    series.reserve(n_dwell_bins);
+}
+
+void Cg_counts::begin_traj(int comm) {
+    series.clear(); curr_comm=comm; t_entry=0.L; first_dwell=true;
+}
+
+/* the discretised trajectory occupies the previous community at all time points before the transition */
+void Cg_counts::update(long double t, int comm) {
+    if (t>maxtime) return; // transitions after the end of the trajectory are not counted
+    while (series.size()*tunit<t) series.push_back(curr_comm);
+    if (comm==curr_comm) return;
+    trans_counts[curr_comm*ncomms+comm]++;
+    comm_times[curr_comm]+=t-t_entry;
+    if (!first_dwell) dwell_hist[curr_comm*n_dwell_bins+static_cast<long long int>((t-t_entry)/tunit)]++;
+    curr_comm=comm; t_entry=t; first_dwell=false;
+}
+
+/* accumulate the transition counts at each lag time for the discretised trajectory. The final dwell of the trajectory is
+   incomplete and is not included in the histogram of dwell times */
+void Cg_counts::end_traj() {
+    while (series.size()*tunit<=maxtime) series.push_back(curr_comm);
+    comm_times[curr_comm]+=maxtime-t_entry;
+    for (int l=0;l<static_cast<int>(lags.size());l++) {
+        for (int m=0;m+lags[l]<static_cast<int>(series.size());m++) lag_counts[l][series[m]*ncomms+series[m+lags[l]]]++; }
+}
+
+void Cg_counts::merge(const Cg_counts &other) {
+    for (int l=0;l<static_cast<int>(lags.size());l++) {
+        for (const pair<const long long int,long long int> &count: other.lag_counts[l]) lag_counts[l][count.first]+=count.second; }
+    for (const pair<const long long int,long long int> &count: other.trans_counts) trans_counts[count.first]+=count.second;
+    for (const pair<const long long int,long long int> &count: other.dwell_hist) dwell_hist[count.first]+=count.second;
+    for (int i=0;i<ncomms;i++) comm_times[i]+=other.comm_times[i];
+}
+
 /* Wrapper_Method handle simulation of many short nonequilibrium trajectories, used to obtain data required for coarse-graining
    a transition network */
-DIMREDN::DIMREDN(const Network &ktn, vector<int> ntrajsvec, long double trajt, \
+DIMREDN::DIMREDN(const Network &ktn, vector<int> ntrajsvec, long double trajt, vector<double> cglagtimes, \
                  const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
 
     cout << "dimredn> setting up simulation of short nonequilibrium trajectories initialised from communities" << endl;
-    this->ntrajsvec=ntrajsvec; this->trajt=trajt;
+    this->ntrajsvec=ntrajsvec; this->trajt=trajt; this->cglagtimes=cglagtimes;
+    for (int i=0;i<static_cast<int>(ntrajsvec.size());i++) {
+        for (int j=0;j<ntrajsvec[i];j++) tasks.push_back(make_pair(i,j)); }
+    esc_stats.resize(ntrajsvec.size()); esc_len_stats.resize(ntrajsvec.size());
 }
 
 DIMREDN::~DIMREDN() {}
 
-/* main loop to simulate many short nonequilibrium trajectories of fixed length starting from each community in turn */
+/* main loop to simulate many short nonequilibrium trajectories of fixed length starting from each community. Each trajectory is
+   a separate task, with its own walker and random number generator, and the tasks are distributed among the threads by the
+   work-stealing scheduler, so that the load is balanced even if the numbers and costs of trajectories differ between communities */
 void DIMREDN::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
     cout << "\n\ndimredn> beginning simulation to obtain trajectory data for dimensionality reduction" << endl;
-    #pragma omp parallel for default(shared)
-    for (int i=0;i<ktn.ncomms;i++) {
-        Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
-        #pragma omp critical
-        cout << "dimredn> thread no.: " << omp_get_thread_num() << "  handling walker: " << walkers[i].walker_id << endl;
-        while (walkers[i].path_no<ntrajsvec[walkers[i].walker_id]) {
-            while (walkers[i].t<=trajt) {
-                traj_method_local->kmc_iteration(ktn,walkers[i]);
-                traj_method_local->dump_traj(walkers[i],false,false,trajt);
-                if (walkers[i].t>trajt) break;
-                traj_method_local->do_bkl_steps(ktn,walkers[i],trajt);
-            }
-            walkers[i].reset_walker_info();
-            walkers[i].path_no++;
-            traj_method_local->reset_nodeptrs();
+    cout << "dimredn> simulating " << tasks.size() << " trajectories from " << ntrajsvec.size() << " communities" << endl;
+    Path_scheduler task_scheduler(tasks.size(),omp_get_max_threads());
+    /* coarse-grained transition counts are accumulated by each thread, for the trajectory discretised at intervals of TINTVL (or
+       of the shortest lag time if trajectory data is not written) */
+    vector<unique_ptr<Cg_counts>> cg_counts;
+    double tunit = tintvl>0.?tintvl:(cglagtimes.empty()?0.:*min_element(cglagtimes.begin(),cglagtimes.end()));
+    if (!cglagtimes.empty()) {
+        vector<int> lags;
+        for (double cglagtime: cglagtimes) lags.push_back(static_cast<int>(round(cglagtime/tunit)));
+        for (int i=0;i<omp_get_max_threads();i++) cg_counts.push_back(unique_ptr<Cg_counts>(new Cg_counts(ntrajsvec.size(),tunit,trajt,lags)));
+    }
+    /* the first escape from the initial community is the first basin escape of each trajectory. If a target relative error is set,
+       the remaining trajectories for a community are skipped once the estimates for the community have converged */
+    vector<atomic<bool>> comm_converged(ntrajsvec.size());
+    for (atomic<bool> &conv: comm_converged) conv=false;
+    omp_lock_t conv_lock; omp_init_lock(&conv_lock);
+    #pragma omp parallel default(shared)
+    {
+    Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+    int task_id, n_tasks=0;
+    while (task_scheduler.next_path(omp_get_thread_num(),task_id)) {
+        if (comm_converged[tasks[task_id].first].load(memory_order_relaxed)) continue;
+        Walker walker{walker_id:tasks[task_id].first,path_no:tasks[task_id].second,k:0,t:0.L, \
+                      p:-numeric_limits<double>::infinity(),s:0.L};
+        Task_rng task_rng(seed,walker.walker_id,walker.path_no);
+        if (!cg_counts.empty()) {
+            walker.cg_counts=cg_counts[omp_get_thread_num()].get();
+            walker.cg_counts->begin_traj(walker.walker_id);
         }
-        delete traj_method_local;
-        cout << "dimredn> thread no.: " << omp_get_thread_num() << " finished handling relevant walker" << endl;
+        long double t_esc=-1.L; long long int k_esc=0; // time and length of first escape (truncated at the end of the trajectory)
+        while (walker.t<=trajt) {
+            traj_method_local->kmc_iteration(ktn,walker);
+            if (t_esc<0.L) { t_esc=min(walker.t,trajt); k_esc=walker.k; }
+            traj_method_local->dump_traj(walker,false,false,trajt);
+            if (walker.t>trajt) break;
+            traj_method_local->do_bkl_steps(ktn,walker,trajt);
+        }
+        if (walker.cg_counts!=nullptr) walker.cg_counts->end_traj();
+        omp_set_lock(&conv_lock);
+        esc_stats[walker.walker_id].update(t_esc); esc_len_stats[walker.walker_id].update(k_esc);
+        if (targeterr>0. && check_comm_convergence(walker.walker_id)) comm_converged[walker.walker_id].store(true,memory_order_relaxed);
+        omp_unset_lock(&conv_lock);
+        walker.reset_walker_info();
+        traj_method_local->reset_nodeptrs();
+        n_tasks++;
+    }
+    delete traj_method_local;
+    #pragma omp critical
+    cout << "dimredn> thread no.: " << omp_get_thread_num() << " finished after simulating " << n_tasks << " trajectories" << endl;
+    }
+    omp_destroy_lock(&conv_lock);
+    cout << "dimredn> convergence report for first escapes from communities (95% confidence intervals, truncated at TRAJT):" << endl;
+    int n_conv=0;
+    for (int i=0;i<static_cast<int>(ntrajsvec.size());i++) {
+        print_estimate("dimredn","community "+to_string(i)+" mean escape time",esc_stats[i]);
+        print_estimate("dimredn","community "+to_string(i)+" mean escape length",esc_len_stats[i]);
+        if (check_comm_convergence(i)) n_conv++;
+    }
+    if (targeterr>0.) cout << "dimredn> target relative error " << targeterr << " was reached for " << n_conv << " of " \
+                           << ntrajsvec.size() << " communities" << endl;
+    if (cg_counts.empty()) return;
+    for (int i=1;i<static_cast<int>(cg_counts.size());i++) cg_counts[0]->merge(*cg_counts[i]);
+    write_cg_matrices(*cg_counts[0],ntrajsvec.size());
+}
+
+/* the estimates for a community are converged when the 95% confidence intervals for the mean time and mean length of the first
+   escape from the community have relative half-widths not exceeding the target */
+bool DIMREDN::check_comm_convergence(int comm) const {
+    return esc_stats[comm].n>=min_conv_samples && esc_stats[comm].rel_err()<=targeterr && esc_len_stats[comm].rel_err()<=targeterr;
+}
+
+/* write the coarse-grained transition count and transition probability matrices at each lag time, the maximum likelihood estimate
+   of the coarse-grained rate matrix, K_ij = N_ij/T_i (where N_ij is the number of observed i->j transitions between communities
+   and T_i is the total time spent in community i), and the histograms of dwell times in communities */
+void DIMREDN::write_cg_matrices(const Cg_counts &cg_counts, int ncomms) {
+    cout << "dimredn> writing coarse-grained transition matrices at " << cglagtimes.size() << " lag times" << endl;
+    ofstream cg_f; cg_f.open("cg_tmtx.dat");
+    cg_f.setf(ios::right,ios::adjustfield); cg_f.setf(ios::scientific,ios::floatfield); cg_f.precision(10);
+    for (int l=0;l<static_cast<int>(cglagtimes.size());l++) {
+        vector<long long int> row_counts(ncomms,0);
+        for (const pair<const long long int,long long int> &count: cg_counts.lag_counts[l]) row_counts[count.first/ncomms]+=count.second;
+        vector<pair<long long int,long long int>> counts(cg_counts.lag_counts[l].begin(),cg_counts.lag_counts[l].end());
+        sort(counts.begin(),counts.end());
+        for (const pair<long long int,long long int> &count: counts) {
+            cg_f << setw(20) << cg_counts.lags[l]*cg_counts.tunit << setw(7) << count.first/ncomms << setw(7) << count.first%ncomms \
+                 << setw(15) << count.second << setw(20) << static_cast<long double>(count.second)/row_counts[count.first/ncomms] << "\n";
+        }
+    }
+    cg_f.close();
+    cg_f.open("cg_ratemtx.dat");
+    vector<long double> diag(ncomms,0.L);
+    vector<pair<long long int,long long int>> counts(cg_counts.trans_counts.begin(),cg_counts.trans_counts.end());
+    sort(counts.begin(),counts.end());
+    for (const pair<long long int,long long int> &count: counts) diag[count.first/ncomms]-=count.second/cg_counts.comm_times[count.first/ncomms];
+    int c=0;
+    for (int i=0;i<ncomms;i++) {
+        cg_f << setw(7) << i << setw(7) << i << setw(20) << diag[i] << "\n";
+        for (;c<static_cast<int>(counts.size()) && counts[c].first/ncomms==i;c++) {
+            cg_f << setw(7) << i << setw(7) << counts[c].first%ncomms << setw(20) << counts[c].second/cg_counts.comm_times[i] << "\n"; }
     }
+    cg_f.close();
+    cg_f.open("cg_dwell.dat");
+    vector<pair<long long int,long long int>> dwells(cg_counts.dwell_hist.begin(),cg_counts.dwell_hist.end());
+    sort(dwells.begin(),dwells.end());
+    for (const pair<long long int,long long int> &dwell: dwells) {
+        cg_f << setw(7) << dwell.first/cg_counts.n_dwell_bins << setw(20) << (dwell.first%cg_counts.n_dwell_bins)*cg_counts.tunit \
+             << setw(15) << dwell.second << "\n"; }
+    cg_f.close();
 }
 
 /* constructor for Traj_Method class */
@@ -401,6 +1150,7 @@ Traj_Method::Traj_Method(const Traj_Method &traj_method_obj) {
 }
 
 void Traj_Method::dump_traj(Walker &walker, bool transnpath, bool newpath, long double maxtime) {
+    if (walker.cg_counts!=nullptr) walker.cg_counts->update(walker.t,walker.curr_node->comm_id);
     if (!transnpath && !newpath && tintvl>0. && walker.t<next_tintvl && walker.t<maxtime) return;
     if (tintvl>=0. && dumpintvls && (walker.t>=next_tintvl || walker.t>maxtime)) {
         walker.dump_walker_info(newpath,next_tintvl,walker.prev_node,true);
@@ -430,7 +1180,7 @@ void BKL::kmc_iteration(const Network &ktn, Walker &walker) {
         next_tintvl=tintvl;
     }
     BKL::bkl(walker,discretetime,ktn.accumprobs,seed);
-    if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visited[walker.curr_node->bin_id]=true;
+    if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visit_bin(walker.curr_node->bin_id);
 }
 
 /* function to take a single kMC step (i.e. propagate trajectory by one internode transition) using the BKL algorithm */
@@ -458,6 +1208,7 @@ void BKL::bkl(Walker &walker, bool discretetime, bool accumprobs, int seed) {
     walker.prev_node = walker.curr_node;
     if (edgeptr!=nullptr) { // left the previously occupied node; advance trajectory
         walker.curr_node = edgeptr->to_node;
+        walker.update_fingerprint(walker.curr_node);
     } else { // self-loop transition, node remains same
         walker.curr_node = walker.prev_node;
         t = walker.curr_node->t;
@@ -23,6 +23,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define __KMC_METHODS_H_INCLUDED__
 
 #include "network.h"
+#include "traj_container.h"
 #include <limits>
 #include <utility>
 #include <unordered_map>
@@ -30,11 +31,110 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <typeinfo>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
+#include <memory>
+#include <deque>
+#include <random>
+#include <atomic>
+#include <thread>
 #include <omp.h>
 
 using namespace std;
 
 class Traj_Method;
+struct Cg_counts;
+
+/* output for a walker file, which is formatted into a large buffer in memory while the trajectory data for a single path is written.
+   The buffer is written to the file, which is opened and then closed again, when it is full and when the handle is destroyed, so
+   that the number of open file descriptors does not grow with the number of walkers */
+struct Buffered_ofstream {
+    static const size_t buf_size=1<<16; // size (bytes) of the buffer at which it is written to file
+    ostringstream f;
+    string fname;
+    bool trunc; // the file is truncated when the buffer is first written (new path), and is appended to otherwise
+    int walker_id, path_no; // walker ID and path number of the walker file
+
+    Buffered_ofstream(const string&,bool,int,int);
+    ~Buffered_ofstream();
+    void end_record(); // write the buffer to file if it is full
+    void write_buf();
+};
+
+/* writer for an output file that is shared by all threads (e.g. "fpp_properties.dat"). Each record (e.g. for a completed path) is
+   written to the file, which is opened when first written to and then kept open, and flushed, serialised by a lock, so that the
+   output is not lost if the simulation is killed */
+class Shared_writer {
+
+    private:
+
+    string fname;
+    ofstream out_f;
+    omp_lock_t lock;
+
+    public:
+
+    Shared_writer(const string&);
+    ~Shared_writer();
+    void write(const char*,size_t); // write a record to file
+    static Shared_writer &fpp_writer(); // writer for the file "fpp_properties.dat"
+};
+
+/* binary record of trajectory output, which is passed from a simulation thread to the asynchronous writer thread */
+struct Traj_record {
+    enum Record_type : unsigned char { walker_info, fpp_properties, close_walker } type;
+    bool newpath, intvl;       // arguments of Walker::dump_walker_info()
+    unsigned long long int seq; // global order in which records were enqueued (set by Async_writer::push())
+    int walker_id, path_no;
+    int node_id, comm_id;      // node for which trajectory data is written
+    unsigned long long int k;
+    long double t, p, s;       // (for walker_info records, t is the time at which trajectory data is written)
+};
+
+/* lock-free ring buffer of trajectory output records, with a single producer (a simulation thread) and a single consumer (the
+   writer thread). The producer waits while the ring is full, so that the memory used for records in flight is bounded */
+class SPSC_ring {
+
+    private:
+
+    vector<Traj_record> slots;
+    size_t mask; // capacity of the ring (a power of two) minus one
+    alignas(64) atomic<size_t> head; // position of the next record to be read by the consumer
+    alignas(64) atomic<size_t> tail; // position of the next record to be written by the producer
+
+    public:
+
+    SPSC_ring(size_t);
+    bool push(const Traj_record&); // returns false if the producer had to wait for the ring to drain
+    const Traj_record *front();    // returns nullptr if the ring is empty
+    void pop();
+};
+
+/* writer thread for trajectory output. Simulation threads enqueue binary records in their own SPSC rings, and the writer thread
+   formats the records and writes them to the walker files and to "fpp_properties.dat", so that text formatting and disk writes
+   are not performed by the simulation threads. Records are written in the order in which they were enqueued, so that the output
+   for a walker is ordered even if the walker is propagated by different threads at different stages of the simulation */
+class Async_writer {
+
+    private:
+
+    vector<unique_ptr<SPSC_ring>> rings; // one ring for each simulation thread
+    thread writer_thread;
+    atomic<bool> stop;
+    atomic<long long int> n_stalls; // number of times that a producer waited for a full ring to drain
+    atomic<unsigned long long int> next_seq; // sequence number of the next record to be enqueued
+    unordered_map<long long int,unique_ptr<Buffered_ofstream>> walker_files; // buffered walker files, keyed by walker ID and path no.
+    ofstream fpp_f;
+
+    void run();
+    void write_record(const Traj_record&);
+
+    public:
+
+    Async_writer(int,size_t);
+    ~Async_writer(); // drains all rings, closes all files, and joins the writer thread
+    void push(const Traj_record&); // enqueue a record in the ring of the calling thread
+    static Async_writer *active; // the writer to which trajectory output is sent (nullptr if output is written synchronously)
+};
 
 /* data structure for a single trajectory (walker) on the Markov chain (KTN) */
 struct Walker {
@@ -46,6 +146,9 @@ struct Walker {
     void dump_walker_info(bool,long double,const Node*,bool=false); // write trajectory data to file
     void dump_fpp_properties(); // append first passage path properties to file
     void reset_walker_info();
+    void update_fingerprint(const Node*); // incorporate a node visited along the trajectory into the path fingerprint
+    void visit_bin(int); // record that a bin has been visited along the path
+    void clear_visited(); // reset the record of visited bins
 
     int walker_id; // ID of walker in set of trajectories
     int path_no; // the trajectory iteration for this walker ID
@@ -55,12 +158,28 @@ struct Walker {
     long double s; // entropy flow along path
     const Node *prev_node, *curr_node; // pointers to nodes previously and currently occupied by the walker
     vector<bool> visited;  // element is true when the corresponding bin has been visited along the trajectory
+    vector<int> visited_bins; // IDs of the bins that have been visited along the trajectory, in order of first visit
+    int fingerprint_mode=0; // path fingerprinting is off (0), or uses the sequence of visited nodes (1) or communities (2)
+    unsigned long long int fingerprint=14695981039346656037ULL; // (FNV-1a) hash of the sequence of visited nodes or communities
+    vector<int> fingerprint_seq; // sequence of visited nodes or communities (consecutive repeats are not recorded)
+    shared_ptr<Buffered_ofstream> walker_f; // handle for the buffered walker file of the current path, kept until the walker is reset
+    shared_ptr<Traj_container_chunk> traj_chunk; // buffered trajectory data of the current path, if written to the trajectory container
+    Cg_counts *cg_counts=nullptr; // accumulator of coarse-grained transition counts to which the trajectory contributes (DIMREDN)
+    long double weight=1.L; // statistical weight of the trajectory (WE)
+};
+
+/* count of a distinct path in the ensemble of simulated paths, which is identified by its fingerprint (a hash that is accumulated
+   along the trajectory) only. The sequence of nodes or communities is stored only while the path is among the most frequently
+   observed paths, so that the memory used does not grow with the total length of all distinct paths */
+struct Path_fingerprint {
+    long long int count=0; // number of occurrences of the path
+    bool top=false; // the path is currently among the most frequently observed paths, and its sequence is stored
 };
 
 /* arguments to be passed to Wrapper_Method object (base class for methods to handle set of trajectories) constructor */
 struct Wrapper_args {
     int nwalkers; int nbins; int nabpaths; double tintvl; int maxit; bool indepcomms; bool adaptivecomms;
-    int seed; bool debug;
+    int seed; bool debug; int nfingerprints; bool fingerprintcomms; double targeterr;
 };
 
 /* arguments to be passed to Traj_Method object (base class for methods to propagate individual trajectories) */
@@ -75,6 +194,164 @@ struct SR_args{
     bool absorption; bool committor;
     bool fundamentalirred; bool fundamentalred;
     bool gth; bool mfpt;
+    int fundblocksz; bool fundstream;
+    double memlimit; const char *scratchfile;
+    bool fptmoments; bool tpt;
+};
+
+/* row of the factorised transition matrix for a node eliminated in a graph transformation, stored explicitly when the
+   back-substitution phase of a state reduction computation does not use the L and U networks */
+struct GT_factor {
+    int node;             // position of the eliminated node
+    long double tau;      // renormalised mean waiting time of the node at the point of its elimination
+    long double factor;   // equal to (1-T_{nn}) at the point of elimination of the node
+    long double pabs;     // renormalised total transition probability to the absorbing set at the point of elimination of the node
+    vector<pair<int,long double>> row; // transition probabilities to nodes that are noneliminated at the point of elimination
+    vector<pair<int,long double>> col; // factors T_{yn}/(1-T_{nn}) for nodes y that are noneliminated at the point of elimination
+                                       // (stored only if required, for forward substitution of additional right-hand sides)
+};
+
+/* lightweight sparse representation of the transition matrix for graph transformation with unbounded fill-in. Self-loops are
+   not stored (the factors (1-T_{nn}) are computed from the off-diagonal elements, cf. the GTH algorithm), and transitions to
+   absorbing nodes are subsumed into a single renormalised probability for each node */
+struct GT_sparse {
+    vector<unordered_map<int,long double>> rows; // off-diagonal transition probabilities between nonabsorbing nodes
+    vector<long double> tau;  // (renormalised) mean waiting times of nodes
+    vector<long double> pabs; // (renormalised) total transition probabilities from nodes to the absorbing set
+    vector<unsigned char> eliminated; // flags for eliminated nodes (not vector<bool>, so that flags can be set concurrently)
+};
+
+/* compact record of the k-th shortest path to a node in the REA, which is the union of the (pred_rank)-th shortest path to the
+   predecessor node and the node itself */
+struct REA_path {
+    double p;            // path cost (i.e. negative log path probability)
+    double t;            // path time
+    double s;            // entropy flow along path
+    int pred_node;       // position of the predecessor node in the nodes vector (-1 for the first shortest path to the source node)
+    int pred_rank;       // rank of the shortest path to the predecessor node of which this path is an extension
+    unsigned int k;      // path length (i.e. no. of steps)
+};
+
+/* candidate for the next shortest path to a node v in the REA, which is the union of the (pred_rank)-th shortest path to the
+   predecessor node u and the node v. For a source node v, the candidate may instead be the path that starts at node v (i.e.
+   the virtual transition from the super-source), which has no predecessor edge. Candidates are ordered by path cost (ties are
+   broken by predecessor node and rank) */
+struct REA_candidate {
+    double p;            // path cost of the candidate path
+    int pred_rank;       // rank of the shortest path to the predecessor node u
+    const Edge *uvedge;  // edge from the predecessor node u to the node v (nullptr for the path starting at the source node v)
+
+    inline bool operator>(const REA_candidate &other_cand) const {
+        if (p!=other_cand.p) return p>other_cand.p;
+        int u=(uvedge==nullptr)?0:uvedge->from_node->node_id;
+        int other_u=(other_cand.uvedge==nullptr)?0:other_cand.uvedge->from_node->node_id;
+        if (u!=other_u) return u>other_u;
+        return pred_rank>other_cand.pred_rank;
+    }
+};
+
+/* node of a persistent leftist heap of sidetrack edges in Eppstein's algorithm. Heaps are never modified once they are built, and
+   heaps that are derived from one another share their unchanged subtrees */
+struct Sidetrack_heapnode {
+    double delta;        // sidetrack cost (i.e. the increase in path cost compared to the shortest path from the edge's from node)
+    const Edge *edge;    // sidetrack edge (nullptr for a virtual transition from the super-source)
+    const Node *to_node; // node to which the sidetrack edge leads
+    int left, right;     // positions of the child heap nodes in the array of heap nodes (-1 if empty)
+    int rank;            // length of the right spine of the subtree rooted at this heap node
+
+    inline bool operator<(const Sidetrack_heapnode &other_hnode) const {
+        if (delta!=other_hnode.delta) return delta<other_hnode.delta;
+        if (to_node->node_id!=other_hnode.to_node->node_id) return to_node->node_id<other_hnode.to_node->node_id;
+        return ((edge==nullptr)?-1:edge->edge_id)<((other_hnode.edge==nullptr)?-1:other_hnode.edge->edge_id);
+    }
+};
+
+/* k-th shortest path in Eppstein's algorithm, represented implicitly by its sequence of sidetrack edges, namely the sequence of
+   sidetracks of the prefix path appended by the sidetrack edge of a heap node */
+struct Eppstein_path {
+    int hnode;           // position of the heap node for the last sidetrack edge of the path (-1 for the first shortest path)
+    int prefix;          // position of the path whose sidetrack sequence is the prefix of that of this path (-1 if none)
+};
+
+/* online estimator of the mean of a sequence of independent observations and of the variance of the observations (Welford's
+   algorithm). Estimators accumulated separately (e.g. by different threads) are combined by the pairwise update of Chan et al. */
+struct Running_stats {
+    long long int n=0;
+    long double mean=0.L, m2=0.L; // mean, and sum of squared deviations from the mean
+
+    void update(long double);
+    void merge(const Running_stats&);
+    long double half_width() const; // half-width of the 95% confidence interval for the mean
+    long double rel_err() const;    // half-width of the confidence interval relative to the magnitude of the mean
+};
+
+/* batch means estimator for a time series of correlated observations (e.g. the hits of A along a steady state trajectory). The
+   observations are summed over consecutive batches of fixed length in time, and the batch means, which are approximately
+   independent if the batches are long compared to the correlation time, are accumulated by a Running_stats estimator */
+struct Batch_means {
+    long double batcht=0.L, t_end=0.L; // length of a batch, and time at which the current batch ends
+    long double sum=0.L;               // sum of the observations in the current batch
+    Running_stats batches;             // estimator for the means (per unit time) of completed batches
+
+    void init(long double,long double);
+    void update(long double,long double); // add an observation at a given time, after closing any batches that have ended
+    void close(long double); // close the batches that have ended by the time at which the trajectory terminates
+};
+
+/* thread-private accumulators of the numbers of A<-B and B<-B paths and of the counts of bin appearances along them, which are
+   merged into the shared counts of the wrapper method after the simulation. The counts for bins are stored densely, or sparsely
+   (only for visited bins) if the number of bins is large */
+struct alignas(64) Tp_stats_accumulator {
+    static const int max_dense_bins=1<<16;
+    int n_ab=0, n_traj=0;
+    bool sparse=false;
+    vector<int> ab_successes, ab_failures;
+    vector<int> touched_bins; // bins with nonzero dense counts, so that merging and clearing the counts do not scan all bins
+    unordered_map<int,pair<int,int>> sparse_counts; // bin ID: (no. of A<-B paths, no. of B<-B paths) along which the bin was visited
+    Running_stats fpt_stats, len_stats; // estimators for the first passage times and lengths of A<-B paths
+
+    void init(int);
+    void clear(); // reset the counts after they have been merged, without reallocating the dense counts
+    void update(Walker&,bool,bool); // c.f. Wrapper_Method::update_tp_stats()
+};
+
+/* random number generator for a task (e.g. a single trajectory), which is used by the thread executing the task instead of the
+   generators that are shared by all threads. The generator is seeded from the task ID, so that the random numbers drawn in the task
+   do not depend on the thread that executes it, or on the order in which the tasks are executed */
+class Task_rng {
+
+    public:
+
+    Task_rng(int,int,int); // the generator is seeded from the seed of the simulation and a two-component task ID
+    ~Task_rng();           // the thread reverts to the shared generators
+    static default_random_engine &get_generator(default_random_engine&); // generator for the calling thread
+
+    private:
+
+    default_random_engine generator;
+    static thread_local default_random_engine *task_generator; // generator of the task being executed by this thread (or nullptr)
+};
+
+/* work-stealing scheduler that distributes the IDs of the paths to be simulated among threads. Each thread takes path IDs from
+   the front of its own deque and, when its deque is empty, steals from the back of the deque of another thread, so that all
+   threads remain busy until no paths remain, even though the costs of simulating individual paths are heavy-tailed */
+class Path_scheduler {
+
+    private:
+
+    struct alignas(64) Path_deque {
+        deque<int> paths;
+        omp_lock_t lock;
+    };
+    vector<Path_deque> deques; // one deque for each thread
+    atomic<long long int> n_steals;
+
+    public:
+
+    Path_scheduler(int,int);
+    ~Path_scheduler();
+    bool next_path(int,int&); // get the ID of the next path to be simulated by a thread, returns false if no paths remain
+    long long int get_n_steals() const { return n_steals; }
 };
 
 /* abstract class for wrapper (trajectory handling) enhanced sampling methods */
@@ -95,6 +372,11 @@ class Wrapper_Method {
     int seed;                   // seed for random number generator
     bool debug;                 // debug printing on/off
     vector<Walker> walkers;     // list of independent trajectories (walkers) on the network
+    double targeterr;           // target relative half-width of confidence intervals, at which the simulation terminates (if >0.)
+    Running_stats fpt_stats;    // online estimator for the first passage times of A<-B paths
+    Running_stats len_stats;    // online estimator for the lengths (no. of steps) of A<-B paths
+    static const int min_conv_samples=30; // min. no. of samples (paths or batches) before convergence is tested
+    static constexpr double min_conv_bin_frac=0.01; // min. fraction of paths visiting a bin for its committor to be tested
     void (*kmc_func)(Walker&);  // function pointer to kMC algorithm for propagating the trajectory   
 
     public:
@@ -104,11 +386,18 @@ class Wrapper_Method {
     virtual void run_enhanced_kmc(const Network&,Traj_Method*)=0; // pure virtual function
     static const Node *get_initial_node(const Network&, Walker&,int); // sample an initial node
     void set_standard_kmc(void(*)(Walker&)); // function to set the kmc_std_method
+    static vector<double> get_source_costs(const Network&); // costs of virtual transitions from a super-source to nodes in B
     static vector<int> find_comm_onthefly(const Network&,const Node*,double,int); // find a community on-the-fly based on max allowed rate and size
     void update_tp_stats(Walker&,bool,bool); // update the transition path statistics, depends on if the path is a transn path or is unreactive
+    void merge_tp_stats(const Tp_stats_accumulator&); // add the counts of a thread-private accumulator to the transition path statistics
     void calc_tp_stats(int);    // calculate the transition path statistics from the observed counts
+    bool check_convergence(int) const; // test if the estimators for A<-B paths have reached the target relative error
+    void write_conv_report(int) const; // print the estimates for A<-B paths with their confidence intervals
+    static void print_estimate(const string&,const string&,const Running_stats&); // print an estimate with its confidence interval
     void write_tp_stats(int);   // write transition path statistics to file
     static long double rand_unif_met(int=19); // draw uniform random number between 0 and 1
+    static int sample_cum_distribn(const vector<pair<int,long double>>&,int); // sample a node from a cumulative distribution
+    static vector<long double> calc_stat_distribn(vector<vector<long double>>); // stationary distribution of a small Markov chain
 
     template <typename T>
     static void write_vec(const vector<T>& vec, string fname, int precision=30) {
@@ -122,6 +411,21 @@ class Wrapper_Method {
 /* no special enhanced sampling, simply propagates the dynamics of A<-B trajectories using the chosen method */
 class BTOA : public Wrapper_Method {
 
+    private:
+
+    static const int n_fp_shards=256; // number of independently locked shards of the hash map of path fingerprints
+    int nfingerprints; // number of most frequently observed distinct paths to write to file (if >0)
+    vector<unordered_map<unsigned long long int,Path_fingerprint>> fingerprint_counts; // counts of distinct A<-B paths
+    vector<omp_lock_t> fingerprint_locks; // locks for the shards of the hash map of path fingerprints
+    unordered_map<unsigned long long int,vector<int>> top_fingerprint_seqs; // sequences of the (at most nfingerprints) most frequent paths
+    omp_lock_t top_fingerprints_lock; // lock for the set of most frequent paths
+    atomic<long long int> top_fingerprints_min; // lower bound on the least count of a path in the (full) set of most frequent paths
+
+    long long int get_fingerprint_count(unsigned long long int);
+
+    void count_fingerprint(Walker&);
+    void write_fingerprints();
+
     public:
 
     BTOA(const Network&,const Wrapper_args&);
@@ -137,10 +441,12 @@ class FIXEDT : public Wrapper_Method {
     long double trajt;     // maximum total time of each trajectory
     bool steadystate;      // use only a small number of trajs (=no. of threads) and record dynamical properties for the steady state TPE
     double ssrec;          // minimum time at which trajs are considered to be equilibriated and recording steady state TPE properties begins
+    double batcht;         // length in time of batches for the batch means estimator of the steady state rate of entering A
+    Running_stats rate_stats; // estimator for the steady state rate of entering A (batch means)
 
     public:
 
-    FIXEDT(const Network&,long double,bool,double,const Wrapper_args&);
+    FIXEDT(const Network&,long double,bool,double,double,const Wrapper_args&);
     ~FIXEDT();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
@@ -152,14 +458,46 @@ class DIMREDN : public Wrapper_Method {
 
     vector<int> ntrajsvec; // vector containing number of trajectories to simulate starting from each community in turn
     long double trajt;     // maximum total time of each trajectory
+    vector<pair<int,int>> tasks; // (community ID, trajectory no.) for all trajectories to be simulated
+    vector<double> cglagtimes; // lag times at which coarse-grained transition matrices are estimated on-the-fly (if not empty)
+    vector<Running_stats> esc_stats, esc_len_stats; // estimators for the times and lengths of the first escapes from communities
+
+    bool check_comm_convergence(int) const;
+    void write_cg_matrices(const Cg_counts&,int);
 
     public:
     
-    DIMREDN(const Network&,vector<int>,long double,const Wrapper_args&);
+    DIMREDN(const Network&,vector<int>,long double,vector<double>,const Wrapper_args&);
     ~DIMREDN();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
 
+/* accumulator of the statistics required to estimate a coarse-grained Markov chain from trajectories (DIMREDN), namely the counts of
+   transitions between communities at lag times, for the trajectory discretised at time intervals, and the numbers of transitions
+   between communities, the total times spent in communities, and the histograms of (completed) dwell times in communities, for
+   the continuous-time trajectory. Each thread has its own accumulator, and the accumulators are merged after the simulation */
+struct Cg_counts {
+    long double tunit;   // time interval between points of the discretised trajectory
+    long double maxtime; // total time of each trajectory
+    vector<int> lags;    // lag times in multiples of tunit
+    vector<unordered_map<long long int,long long int>> lag_counts; // sparse transition count matrix at each lag (key: i*ncomms+j)
+    unordered_map<long long int,long long int> trans_counts; // no. of transitions between communities (key: i*ncomms+j)
+    unordered_map<long long int,long long int> dwell_hist; // no. of dwells in communities (key: comm*n_dwell_bins+bin, bin width tunit)
+    vector<long double> comm_times; // total time spent in each community
+    long long int ncomms, n_dwell_bins;
+    // state of the current trajectory
+    vector<int> series;  // community occupied at each point of the discretised trajectory
+    int curr_comm;
+    long double t_entry; // time at which the current community was entered
+    bool first_dwell;    // the current dwell began at the start of the trajectory (so is not a completed dwell)
+
+    Cg_counts(int,long double,long double,const vector<int>&);
+    void begin_traj(int);
+    void update(long double,int); // the trajectory has entered a community at a time
+    void end_traj();
+    void merge(const Cg_counts&);
+};
+
 /* Weighted ensemble sampling */
 class WE : public Wrapper_Method {
 
@@ -167,12 +505,17 @@ class WE : public Wrapper_Method {
 
     double taure; // time interval between checking communities and resampling trajectories
     double adaptminrate;
+    bool discretetime; // transition probabilities represent a discrete-time Markov chain
+    vector<int> commstargs; // target number of walkers in each community
+    long double flux_a=0.L; // total weight of walkers that have reached the absorbing state A
 
-    void we_resampling();
+    void propagate_walker(const Network&,Traj_Method*,Walker&,long double,long double&,int&);
+    void we_resampling(const Network&,int);
+    void resample_comm(vector<Walker>&,int);
 
     public:
 
-    WE(const Network&,double,const Wrapper_args&);
+    WE(const Network&,double,const vector<int>&,bool,const Wrapper_args&);
     ~WE();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
@@ -182,21 +525,57 @@ class FFS : public Wrapper_Method {
 
     private:
 
-    // ...
+    int ntrials;                   // number of trial trajectories fired from each interface
+    vector<double> order_params;   // value of the order parameter for each node
+    vector<double> interfaces;     // values of the order parameter at the interfaces (the final interface is the A set)
+    double pprune;                 // probability of pruning a trial trajectory that falls back across an earlier interface
+    vector<vector<pair<int,long double>>> pools; // positions of the nodes at which trajectories first crossed each interface
+                                                 // (configurations), with cumulative statistical weights
+
+    bool crossed_interface(const Node*,int) const;
+    long double initial_flux(const Network&,Traj_Method*);
+    int fire_trials(const Network&,Traj_Method*,int);
 
     public:
 
-    FFS(const Network&,const Wrapper_args&);
+    FFS(const Network&,int,const vector<double>&,const vector<double>&,double,const Wrapper_args&);
     ~FFS();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
 
+/* statistics of the excursions of NEUS walkers that began at an entry point (node) of a window and ended when the walker left the
+   window, at an entry point of another window (or at A, in which case the walker was recycled to a node of B) */
+struct Neus_entry_stats {
+    long long int n_exc=0;      // number of completed excursions
+    long long int n_a=0;        // number of excursions that ended at A
+    long double tot_time=0.L;   // total duration of the completed excursions
+    unordered_map<int,long long int> exits; // counts of the entry points at which the excursions ended
+};
+
 /* non-equilibrium umbrella sampling kMC */
 class NEUS : public Wrapper_Method {
 
+    private:
+
+    int nwinwalkers;            // number of walkers confined to each window
+    double taure;               // time interval between updates of the window weights
+    bool discretetime;          // transition probabilities represent a discrete-time Markov chain
+    int comm_a;                 // community of the A set
+    vector<vector<Walker>> win_walkers;            // pool of walkers confined to each window
+    vector<vector<pair<int,long double>>> walker_entries; // entry point and entry time of the current excursion of each walker
+    vector<long double> win_weights;               // steady state weight of each window
+    vector<long double> win_times;                 // total time simulated in each window
+    vector<unordered_map<int,Neus_entry_stats>> entry_stats; // statistics of excursions from the entry points of each window
+    vector<vector<pair<int,long double>>> entry_probs;   // cumulative distribution of the entry points of each window
+    vector<vector<pair<int,long double>>> init_probs;    // cumulative distribution of nodes of each window at equilibrium
+    long double k_ab=0.L;       // estimate of the A<-B rate constant
+
+    void propagate_window(const Network&,Traj_Method*,int,int,long double,long double&,int&);
+    void update_weights(const Network&);
+
     public:
 
-    NEUS(const Network&,const Wrapper_args&);
+    NEUS(const Network&,int,double,bool,const Wrapper_args&);
     ~NEUS();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
@@ -204,9 +583,27 @@ class NEUS : public Wrapper_Method {
 /* milestoning kMC */
 class MILES : public Wrapper_Method {
 
+    private:
+
+    int ntrajs;                 // number of trajectories launched from each milestone
+    int comm_a;                 // community of the A set
+    int ncomms;                 // number of communities
+    int m_b;                    // ID of the virtual milestone of the B set (the last milestone)
+    unordered_map<int,int> milestone_ids;          // ID of the milestone between communities I<J, key is I*ncomms+J
+    vector<pair<int,int>> milestones;              // pair of communities for each milestone
+    vector<bool> absorbing;                        // milestone is the boundary of the community of the A set
+    vector<vector<pair<int,long double>>> launch_probs; // cumulative equilibrium distribution of first hitting points of milestones
+    vector<vector<long long int>> kernel_counts;   // no. of trajectories from each milestone that hit each adjacent milestone
+    vector<long double> lifetimes;                 // mean lifetime of each milestone
+    vector<long double> stat_flux;                 // stationary flux through each milestone
+    vector<long double> mfpts;                     // mean first passage time to A from each milestone
+
+    int find_milestone(int,int) const;
+    void solve_milestones();
+
     public:
 
-    MILES(const Network&,const Wrapper_args&);
+    MILES(const Network&,int,const Wrapper_args&);
     ~MILES();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
@@ -219,24 +616,59 @@ class REA : public Wrapper_Method {
     bool discretetime;
     bool writerea;    // write all trajectory information for shortest paths
     bool reanotirred; // if true, indicates that candidate paths to nodes may not exist (i.e. set of shortest paths to one or more nodes may be finite)
-    const Node *source_node, *sink_node; // pointers to source and sink nodes
-    vector<vector<Walker>> shortest_paths; // k-th shortest paths to all nodes of the network
-    vector<vector<pair<const Walker*,const Edge*>>> candidate_paths; // pointers to possible candidates for next shortest path to each node of the network
+    double deltastep; // bucket width for the Delta-stepping algorithm (if <0., Dijkstra's algorithm is used; if =0., the width is chosen automatically)
+    vector<double> source_costs; // costs of the virtual transitions from the super-source to the source nodes (in B)
+    vector<vector<REA_path>> shortest_paths; // k-th shortest paths to all nodes of the network (arrays grow as paths are found)
+    vector<vector<REA_candidate>> candidate_paths; // possible candidates for next shortest path to each node of the network,
+        // each of which is a binary min-heap ordered by path cost
     vector<bool> nomorecands; // if Markov chain is not irreducible, record nodes for which no more candidate paths are available
+    vector<bool> pruned; // nodes that do not lie on any first passage path from the source node to the sink node
 
     void dijkstra(const Network&);
+    void deltastepping(const Network&);
     void next_path(const Node&,int);
-    void add_candidate(const Walker*,const Edge*);
+    void add_candidate(int,const Edge*);
     void select_candidate(const Node&,int);
-    void print_shortest_paths(int);
+    void print_shortest_paths(const Network&,const vector<pair<int,int>>&);
 
     public:
 
-    REA(const Network&,bool,bool,bool,const Wrapper_args&);
+    REA(const Network&,bool,bool,bool,double,const Wrapper_args&);
     ~REA();
     void run_enhanced_kmc(const Network&, Traj_Method*);
 };
 
+/* Eppstein's algorithm for k shortest paths problem, using persistent heaps of sidetrack edges */
+class EPPSTEIN : public Wrapper_Method {
+
+    private:
+
+    bool discretetime;
+    bool writerea;    // write all trajectory information for shortest paths
+    vector<double> source_costs; // costs of the virtual transitions from the super-source to the source nodes (in B)
+    int source_heap; // position of the root of the heap of sidetrack edges for the super-source in the array of heap nodes
+    const Node *source_next; // source node that is the successor of the super-source in the shortest path tree
+    vector<bool> pruned; // nodes that do not lie on any first passage path from the source node to the sink node
+    vector<double> dist; // cost of the shortest path from each node to the sink node
+    vector<const Edge*> next_edge; // edges to successor nodes in the shortest path tree rooted at the sink node
+    vector<int> heap_roots; // positions of the roots of the heaps of sidetrack edges for all nodes in the array of heap nodes
+    vector<Sidetrack_heapnode> heap_nodes; // nodes of all persistent heaps of sidetrack edges
+    vector<Eppstein_path> candidate_paths; // all candidate paths to the sink node (array grows as candidates are found)
+    vector<int> shortest_paths; // positions of the k shortest paths to the sink node in the array of candidate paths
+
+    void reverse_dijkstra(const Network&,vector<int>&);
+    void build_heaps(const Network&,const vector<int>&);
+    int merge_heaps(int,int);
+    vector<const Edge*> get_path_edges(int,const Node*&) const;
+    void print_shortest_path(const Network&,const vector<const Edge*>&,const Node*,int) const;
+
+    public:
+
+    EPPSTEIN(const Network&,bool,bool,const Wrapper_args&);
+    ~EPPSTEIN();
+    void run_enhanced_kmc(const Network&, Traj_Method*);
+};
+
 /* abstract class for methods to propagate individual trajectories */
 class Traj_Method {
 
@@ -299,7 +731,7 @@ class KPS : public Traj_Method {
     bool adaptivecomms;
     double adaptminrate; // maximum allowed rate in finding a community on-the-fly
     int kpskmcsteps; // number of kMC steps to run after each kPS trapping basin escape trajectory sampled
-    SR_args sr_args{false,false,false,false,false,false}; // object containing bool values specifying which state reduction procedures to perform
+    SR_args sr_args{false,false,false,false,false,false,0,false,-1.,nullptr,false,false}; // object containing bool values specifying which state reduction procedures to perform
     vector<long double> mfpt_vals; // vector of MFPTs (elem is non-zero for non-absorbing nodes)
     long double mu; // sum of (unnormalised) stationary probabilities in GTH algorithm
 
@@ -315,10 +747,19 @@ class KPS : public Traj_Method {
     void reset_nodeptrs();
     void calc_committor(const Network&);
     void calc_absprobs(); void calc_mfpt(); void calc_gth();
+    void calc_fundamentalirred(const Network&);
     void calc_fundamentalred(const Network&);
+    void calc_allpairs(const Network&,bool);
+    void calc_outofcore(const Network&);
+    void calc_tpt(const Network&,const vector<long double>&,const vector<long double>&);
+    static vector<long double> calc_backward_committor(const Network&);
     void write_renormalised_probs(string);
     void rewrite_stat_probs(const Network&);
     static long double committor_boundary_node(const Network&,int,const vector<long double>,int);
+    static GT_sparse get_gt_sparse(const Network&,bool,bool=false);
+    static vector<long double> get_init_probs(const Network&);
+    static void write_gt_factors(ofstream&,const vector<GT_factor>&);
+    static void read_gt_factors(ifstream&,vector<GT_factor>&,int);
 
     public:
 
@@ -334,6 +775,33 @@ class KPS : public Traj_Method {
     static unsigned long long int negbinomial_distribn(unsigned long long int,long double,int);
     static long double exp_distribn(long double,int);
     static void test_ktn(const Network&);
+    static long long int gt_sparse_iteration(GT_sparse&,int,vector<GT_factor>&,bool=false);
+};
+
+/* absorbing Markov chain for a trapping basin (community) in MCAMC, which is computed when the basin is first visited and is then
+   kept for the whole simulation. The absorbing states are the nodes at the boundary of the basin */
+struct Mcamc_basin {
+    atomic<bool> ready{false};  // the absorbing Markov chain for the basin has been computed
+    omp_lock_t lock;            // lock held while the absorbing Markov chain for the basin is computed
+    unordered_map<int,int> node_ids; // local index of each node of the basin, key is node position
+    vector<int> exits;          // positions of the absorbing boundary nodes
+    // mean rate method
+    vector<vector<pair<int,long double>>> exit_probs; // cumulative probabilities for absorption at boundary nodes from each node
+    vector<long double> mfpts;  // mean times for escape from the basin from each node
+    // FPTA method
+    vector<long double> evals;  // eigenvalues of the symmetrised transition probability matrix of the transient (basin) nodes
+    vector<vector<long double>> evecs; // corresponding eigenvectors (the k-th eigenvector is evecs[.][k])
+    vector<long double> sqrt_pi; // square roots of the (relative) stationary probabilities of the nodes
+    vector<long double> surv_coeffs; // coefficients of the eigenmodes for the survival probability
+    vector<vector<long double>> exit_coeffs; // coefficients of the eigenmodes for absorption at each boundary node
+};
+
+/* cache of the absorbing Markov chains for all basins, which is shared by the copies of the MCAMC object for all threads */
+struct Mcamc_cache {
+    vector<Mcamc_basin> basins;
+
+    Mcamc_cache(int);
+    ~Mcamc_cache();
 };
 
 /* Monte Carlo with absorbing Markov chains (MCAMC) */
@@ -344,6 +812,15 @@ class MCAMC : public Traj_Method {
     int kpskmcsteps; // number of kMC steps to run after each MCAMC trapping basin escape trajectory sampled
     bool meanrate; // if True, use (approximate) mean rate method, else use (exact) FPTA method
     const Node *alpha=nullptr, *epsilon=nullptr; // final and initial microstates of current escape trajectory
+    shared_ptr<Mcamc_cache> cache; // absorbing Markov chains for the basins
+
+    const Mcamc_basin &get_basin(const Network&,int);
+    void setup_basin(const Network&,int,Mcamc_basin&);
+    void setup_meanrate(const Network&,const vector<int>&,const vector<vector<pair<int,long double>>>&,Mcamc_basin&);
+    void setup_fpta(const Network&,const vector<int>&,const vector<vector<pair<int,long double>>>&,Mcamc_basin&);
+    unsigned long long int sample_nhops(const Mcamc_basin&,int);
+    int sample_exit(const Mcamc_basin&,int,unsigned long long int);
+    static void jacobi_eigen(vector<vector<long double>>&,vector<long double>&,vector<vector<long double>>&);
 
     public:
 
@@ -83,6 +83,9 @@ void KPS::set_statereduction_procs(const SR_args &sr_args) {
     this->sr_args.absorption=sr_args.absorption; this->sr_args.committor=sr_args.committor;
     this->sr_args.fundamentalirred=sr_args.fundamentalirred; this->sr_args.fundamentalred=sr_args.fundamentalred;
     this->sr_args.gth=sr_args.gth; this->sr_args.mfpt=sr_args.mfpt;
+    this->sr_args.fundblocksz=sr_args.fundblocksz; this->sr_args.fundstream=sr_args.fundstream;
+    this->sr_args.memlimit=sr_args.memlimit; this->sr_args.scratchfile=sr_args.scratchfile;
+    this->sr_args.fptmoments=sr_args.fptmoments; this->sr_args.tpt=sr_args.tpt;
 }
 
 void KPS::test_ktn(const Network &ktn) {
@@ -104,13 +107,23 @@ void KPS::test_ktn(const Network &ktn) {
 /* perform a single kPS basin escape iteration */
 void KPS::kmc_iteration(const Network &ktn, Walker &walker) {
 
+    /* standalone computations that do not use the kPS subnetwork. The COMMITTOR and MFPT computations use the sparse graph
+       transformation (with pruning of nodes and parallel transformation of independent components) unless they are combined
+       with computations that require the dense kPS subnetwork */
+    if (statereduction && (sr_args.fundamentalirred || sr_args.fundamentalred || sr_args.memlimit>0. || sr_args.fptmoments || \
+        !(sr_args.absorption || sr_args.gth))) {
+        if (sr_args.fundamentalirred) { calc_fundamentalirred(ktn);
+        } else if (sr_args.fundamentalred) { calc_fundamentalred(ktn);
+        } else { calc_outofcore(ktn); }
+        return;
+    }
     if (!(!adaptivecomms && ktn.ncomms==2 && ktn_kps_orig!=nullptr)) { // for a two-state problem, only need to setup basin and do GT once
         setup_basin_sets(ktn,walker,true);
         graph_transformation(ktn);
     } else {
         setup_basin_sets(ktn,walker,false); // get the new initial node without updating the definition of the basin
     }
-    if (statereduction && !sr_args.fundamentalirred && !sr_args.mfpt && !sr_args.gth) {
+    if (statereduction && !sr_args.mfpt && !sr_args.gth) {
         return;
     } else if (!statereduction) {
         Node *dummy_alpha = sample_absorbing_node();
@@ -144,7 +157,7 @@ void KPS::do_bkl_steps(const Network &ktn, Walker &walker, long double maxtime)
     while ((n_kmcit<kpskmcsteps || ktn.comm_sizes[epsilon->comm_id]>nelim) && walker.t<maxtime) { // quack force BKL simulation to continue if active community is large
         BKL::bkl(walker,discretetime,ktn.accumprobs,seed);
         alpha=walker.curr_node;
-        if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visited[alpha->bin_id]=true;
+        if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visit_bin(alpha->bin_id);
         if (alpha->comm_id!=epsilon->comm_id || walker.t>maxtime) { // traj data is not dumped unless comm changes, regardless of tintvl, except if (DIMREDN) max time is exceeded
             this->dump_traj(walker,walker.curr_node->aorb==-1,false,maxtime); }
         epsilon=alpha;
@@ -404,7 +417,7 @@ void KPS::graph_transformation(const Network &ktn) {
     ktn_kps=get_subnetwork(ktn,true);
     ktn_kps->ncomms=ktn.ncomms;
     /* the original, L and U network are not needed for certain state reduction computations, which only require a forward pass phase of GT */
-    if (!statereduction || sr_args.fundamentalirred || sr_args.mfpt || sr_args.gth) {
+    if (!statereduction || sr_args.mfpt || sr_args.gth) {
     ktn_kps_orig=get_subnetwork(ktn,false);
     ktn_l = new Network(N_B+N_c,0);
     ktn_u = new Network(N_B+N_c,0);
@@ -428,7 +441,6 @@ void KPS::graph_transformation(const Network &ktn) {
     };
     priority_queue<Node*,vector<Node*>,decltype(cmp)> gt_pq(cmp); // priority queue of nodes (based on out-degree)
     for (vector<Node>::iterator it_nodevec=ktn_kps->nodes.begin();it_nodevec!=ktn_kps->nodes.end();++it_nodevec) {
-        if (sr_args.fundamentalred && !it_nodevec->flag) continue; // only eliminate dummy nodes when computing the absorbing fundamental matrix
         if ((!adaptivecomms && it_nodevec->comm_id!=epsilon->comm_id) || \
             (adaptivecomms && basin_ids[it_nodevec->node_id-1]!=2)) continue;
         gt_pq.push(&(*it_nodevec));
@@ -463,7 +475,6 @@ void KPS::graph_transformation(const Network &ktn) {
     if (debug) cout << "kps> finished graph transformation" << endl;
     if (statereduction) rewrite_stat_probs(ktn); // the stationary probs of initial nodes in the ktn_kps object are rewritten to be the initial probs
     if (sr_args.absorption) calc_absprobs(); // only nodes not in A remain at this point; compute absorption probabilities
-    if (sr_args.fundamentalred) calc_fundamentalred(ktn); // the remaining edges are the elements of the fundamental matrix for a reducible Markov chain
 }
 
 /* return the subnetwork corresponding to the active trapping basin and absorbing boundary nodes, to be transformed
@@ -542,7 +553,7 @@ void KPS::gt_iteration(Node *node_elim) {
     // vector of which relevant entries are for all nodes directly connected to the current elimd node, incl elimd nodes
     vector<nbrnode> nbrnode_vec(N_B+N_c,(nbrnode){false,0.L,0.L});
     // update the self-loops of the L and U networks
-    if (!statereduction || sr_args.fundamentalirred || sr_args.mfpt || sr_args.gth) {
+    if (!statereduction || sr_args.mfpt || sr_args.gth) {
     ktn_u->nodes[node_elim->node_pos].t = -factor;
     ktn_l->nodes[node_elim->node_pos].t = node_elim->t/factor;
     }
@@ -556,7 +567,7 @@ void KPS::gt_iteration(Node *node_elim) {
         nodes_nbrs.push_back(edgeptr->to_node); // queue nbr node
         nbrnode_vec[edgeptr->to_node->node_pos].t_fromn=edgeptr->t;
         nbrnode_vec[edgeptr->to_node->node_pos].t_ton=edgeptr->rev_edge->t;
-        if (!statereduction || sr_args.fundamentalirred || sr_args.mfpt || sr_args.gth) {
+        if (!statereduction || sr_args.mfpt || sr_args.gth) {
         // update L and U networks
         ktn_l->edges[ktn_l->n_edges].t = edgeptr->rev_edge->t/factor;
         ktn_l->edges[ktn_l->n_edges].edge_id = ktn_l->n_edges;
@@ -788,20 +799,21 @@ void KPS::update_path_quantities(Walker &walker, long double t_traj, const Node
     if (ktn_kps==nullptr) throw exception();
     walker.prev_node = walker.curr_node;
     walker.curr_node = &(*curr_node);
+    walker.update_fingerprint(walker.curr_node);
     walker.t += t_traj;
     for (const auto &node: ktn_kps->nodes) {
         if (!ktn_kps->branchprobs && node.h>0) {
             walker.k += node.h;
             walker.p += -1.L*static_cast<long double>(node.h)*log(node.t);
             // no need to update entropy flow along paths because contribution from self-loop transitions is zero
-            if (ktn_kps->ncomms>0 && !walker.visited.empty()) walker.visited[node.bin_id]=true;
+            if (ktn_kps->ncomms>0 && !walker.visited.empty()) walker.visit_bin(node.bin_id);
         }
         Edge *edgeptr = node.top_from;
         while (edgeptr!=nullptr) {
             if (edgeptr->deadts || edgeptr->h==0) { edgeptr=edgeptr->next_from; continue; }
             walker.k += edgeptr->h;
             walker.p += -1.L*static_cast<long double>(edgeptr->h)*log(edgeptr->t);
-            if (ktn_kps->ncomms>0 && !walker.visited.empty()) walker.visited[edgeptr->to_node->bin_id]=true;
+            if (ktn_kps->ncomms>0 && !walker.visited.empty()) walker.visit_bin(edgeptr->to_node->bin_id);
             if (!discretetime) {
                 walker.s += static_cast<long double>(edgeptr->h)*(edgeptr->rev_edge->k-edgeptr->k);
             } else {
@@ -817,7 +829,7 @@ long double KPS::gamma_distribn(unsigned long long int a, long double b, int see
 
     static default_random_engine generator(seed);
     gamma_distribution<long double> gamma_distrib(a,b);
-    return gamma_distrib(generator);
+    return gamma_distrib(Task_rng::get_generator(generator));
 }
 
 /* Binomial distribution with trial number h and success probability p.
@@ -830,7 +842,7 @@ cout << "h: " << h << " p: " << p << endl; throw exception(); } // quack
     if (h==0 || p==0.)  { return 0;
     } else if (p==1.) { return h; }
     binomial_distribution<unsigned long long int> binom_distrib(h,p);
-    return binom_distrib(generator);
+    return binom_distrib(Task_rng::get_generator(generator));
 }
 
 /* Negative binomial distribution with success number r and success probability p.
@@ -841,7 +853,7 @@ unsigned long long int KPS::negbinomial_distribn(unsigned long long int r, long
     if (!(r>=0 && (p>0. && p<=1.)) && !(r==0 &p==0.)) { cout << "r: " << r << " p: " << p << endl; throw exception(); }
     if (r==0) return 0;
     negative_binomial_distribution<unsigned long long int> neg_binom_distrib(r,p);
-    return neg_binom_distrib(generator);
+    return neg_binom_distrib(Task_rng::get_generator(generator));
 }
 
 /* Exponential distribution with rate parameter 1./tau */
@@ -849,5 +861,5 @@ long double KPS::exp_distribn(long double tau, int seed) {
 
     static default_random_engine generator(seed);
     exponential_distribution<long double> exp_distrib(1.L/tau);
-    return exp_distrib(generator);
+    return exp_distrib(Task_rng::get_generator(generator));
 }
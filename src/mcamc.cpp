@@ -22,34 +22,322 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "kmc_methods.h"
+#include <queue>
+#include <cmath>
+#include <iostream>
 
 using namespace std;
 
+Mcamc_cache::Mcamc_cache(int ncomms) : basins(ncomms) {
+    for (Mcamc_basin &basin: basins) omp_init_lock(&basin.lock);
+}
+
+Mcamc_cache::~Mcamc_cache() {
+    for (Mcamc_basin &basin: basins) omp_destroy_lock(&basin.lock);
+}
+
 MCAMC::MCAMC(const Network &ktn, int kpskmcsteps, bool meanrate, \
              const Traj_args &traj_args) : Traj_Method(traj_args) {
 
     cout << "kps> MCAMC parameters:\n  FPTA (0) or mean rate method (1)?: " << meanrate \
          << "\n  no. of kMC steps after MCAMC iteration: " << kpskmcsteps << endl;
     this->kpskmcsteps=kpskmcsteps; this->meanrate=meanrate;
+    cache = make_shared<Mcamc_cache>(ktn.ncomms);
 }
 
 MCAMC::~MCAMC() {}
 
+/* copies of the MCAMC object (one for each thread) share the cache of absorbing Markov chains */
 MCAMC::MCAMC(const MCAMC &mcamc_obj) : Traj_Method(mcamc_obj) {
     this->kpskmcsteps=mcamc_obj.kpskmcsteps; this->meanrate=mcamc_obj.meanrate;
+    this->cache=mcamc_obj.cache;
 }
 
+/* perform a single MCAMC basin escape iteration. The number of steps of the escape trajectory and the absorbing boundary node
+   at which the trajectory exits the basin are sampled from the absorbing Markov chain for the current basin. In the (exact) FPTA
+   method, the number of steps is sampled from the first passage time distribution, and the exit node is sampled conditional on
+   the number of steps. In the (approximate) mean rate method, the exit node is sampled from the absorption probabilities, and
+   the number of steps is sampled from a geometric distribution with the mean escape time. The time for the escape trajectory
+   is then sampled from the gamma distribution (or is deterministic, for a DTMC). The path action and entropy flow are not
+   updated, since the escape trajectory itself is not sampled */
 void MCAMC::kmc_iteration(const Network &ktn, Walker &walker) {
 
-    cout << "mcamc> running a single iteration of MCAMC" << endl;
+    if (!epsilon) { // first iteration of A<-B path, need to set starting node
+        epsilon = Wrapper_Method::get_initial_node(ktn,walker,seed);
+        if (tintvl>=0.) walker.dump_walker_info(true,0.,walker.curr_node,dumpintvls);
+        next_tintvl=tintvl;
+    }
+    const Mcamc_basin &basin = get_basin(ktn,epsilon->comm_id);
+    int i = basin.node_ids.at(epsilon->node_pos);
+    unsigned long long int nhops; // number of steps of the escape trajectory
+    if (meanrate) {
+        alpha = &ktn.nodes[Wrapper_Method::sample_cum_distribn(basin.exit_probs[i],seed)];
+        nhops = 1+KPS::negbinomial_distribn(1,min(1.L,epsilon->t_esc/basin.mfpts[i]),seed);
+    } else {
+        nhops = sample_nhops(basin,i);
+        alpha = &ktn.nodes[sample_exit(basin,i,nhops)];
+    }
+    if (debug) cout << "mcamc> escape from node " << epsilon->node_id << " to node " << alpha->node_id \
+                    << " in " << nhops << " steps" << endl;
+    walker.prev_node = walker.curr_node;
+    walker.curr_node = alpha;
+    walker.update_fingerprint(walker.curr_node);
+    walker.k += nhops;
+    if (discretetime) { walker.t += static_cast<long double>(nhops)*epsilon->t_esc;
+    } else { walker.t += KPS::gamma_distribn(nhops,epsilon->t_esc,seed); } // waiting times are uniform (linearised transn prob mtx)
+    if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visit_bin(alpha->bin_id);
+    epsilon=alpha; alpha=nullptr;
 }
 
-/* perform specified number of BKL iterations after a basin escape */
+/* perform specified number of BKL iterations after a basin escape (cf KPS::do_bkl_steps()) */
 void MCAMC::do_bkl_steps(const Network &ktn, Walker &walker, long double maxtime) {
 
-    cout << "mcamc> doing BKL steps after a basin escape" << endl;
+    int n_kmcit=0;
+    while (n_kmcit<kpskmcsteps && walker.t<maxtime) {
+        BKL::bkl(walker,discretetime,ktn.accumprobs,seed);
+        alpha=walker.curr_node;
+        if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visit_bin(alpha->bin_id);
+        if (alpha->comm_id!=epsilon->comm_id || walker.t>maxtime) { // traj data is not dumped unless comm changes, regardless of tintvl, except if (DIMREDN) max time is exceeded
+            this->dump_traj(walker,walker.curr_node->aorb==-1,false,maxtime); }
+        epsilon=alpha;
+        if (alpha->aorb==-1 || alpha->aorb==1) return; // note that the BKL iterations are terminated if the simulation returns to B
+        n_kmcit++;
+    }
 }
 
 void MCAMC::reset_nodeptrs() {
     epsilon=nullptr; alpha=nullptr;
 }
+
+/* return the absorbing Markov chain for a basin, which is computed (by one thread) if the basin has not been visited before */
+const Mcamc_basin &MCAMC::get_basin(const Network &ktn, int comm_id) {
+    Mcamc_basin &basin = cache->basins[comm_id];
+    if (!basin.ready.load(memory_order_acquire)) {
+        omp_set_lock(&basin.lock);
+        if (!basin.ready.load(memory_order_relaxed)) {
+            setup_basin(ktn,comm_id,basin);
+            basin.ready.store(true,memory_order_release);
+        }
+        omp_unset_lock(&basin.lock);
+    }
+    return basin;
+}
+
+/* find the nodes of a basin and its absorbing boundary, and the transition probabilities from the nodes of the basin (excluding
+   self-loops), where the local indices of the boundary nodes follow those of the basin nodes */
+void MCAMC::setup_basin(const Network &ktn, int comm_id, Mcamc_basin &basin) {
+
+    vector<int> basin_nodes; // positions of the nodes of the basin
+    for (const Node &node: ktn.nodes) {
+        if (node.comm_id!=comm_id) continue;
+        basin.node_ids[node.node_pos]=basin_nodes.size();
+        basin_nodes.push_back(node.node_pos);
+    }
+    int n_b=basin_nodes.size();
+    unordered_map<int,int> exit_ids;
+    vector<vector<pair<int,long double>>> tmtx(n_b);
+    for (int i=0;i<n_b;i++) {
+        const Node &node=ktn.nodes[basin_nodes[i]];
+        const Edge *edgeptr=node.top_from;
+        long double prev_cum_t=node.t;
+        while (edgeptr!=nullptr) {
+            long double t=ktn.accumprobs?edgeptr->t-prev_cum_t:edgeptr->t; // transition probability
+            prev_cum_t=edgeptr->t;
+            if (!edgeptr->deadts) {
+                int j, pos=edgeptr->to_node->node_pos;
+                if (edgeptr->to_node->comm_id==comm_id) {
+                    j=basin.node_ids[pos];
+                } else {
+                    unordered_map<int,int>::iterator it_id=exit_ids.find(pos);
+                    if (it_id==exit_ids.end()) {
+                        j=n_b+basin.exits.size(); exit_ids[pos]=j; basin.exits.push_back(pos);
+                    } else { j=it_id->second; }
+                }
+                tmtx[i].push_back(make_pair(j,t));
+            }
+            edgeptr=edgeptr->next_from;
+        }
+    }
+    if (basin.exits.empty()) {
+        cout << "mcamc> error: community " << comm_id << " has no absorbing boundary" << endl; exit(EXIT_FAILURE); }
+    if (debug) cout << "mcamc> setting up absorbing Markov chain for community " << comm_id << " with " << n_b \
+                    << " nodes and " << basin.exits.size() << " absorbing boundary nodes" << endl;
+    if (meanrate) { setup_meanrate(ktn,basin_nodes,tmtx,basin);
+    } else { setup_fpta(ktn,basin_nodes,tmtx,basin); }
+}
+
+/* compute the absorption probabilities and the mean escape times from each node of a basin by graph transformation. The basin
+   nodes are eliminated in order of (dynamically updated) minimum degree, and the boundary nodes, which are never eliminated, are
+   the absorbing states. The quantities for the eliminated nodes are then obtained by back-substitution */
+void MCAMC::setup_meanrate(const Network &ktn, const vector<int> &basin_nodes, \
+                           const vector<vector<pair<int,long double>>> &tmtx, Mcamc_basin &basin) {
+
+    int n_b=basin_nodes.size(), n_x=basin.exits.size();
+    GT_sparse gt;
+    gt.rows.resize(n_b+n_x); gt.tau.assign(n_b+n_x,0.L); gt.pabs.assign(n_b+n_x,0.L);
+    gt.eliminated.assign(n_b+n_x,false);
+    for (int i=0;i<n_b;i++) {
+        gt.tau[i]=ktn.nodes[basin_nodes[i]].t_esc;
+        for (const pair<int,long double> &elem: tmtx[i]) gt.rows[i][elem.first]+=elem.second;
+    }
+    for (int i=n_b;i<n_b+n_x;i++) gt.eliminated[i]=true; // absorbing boundary nodes
+    vector<GT_factor> factors; factors.reserve(n_b);
+    priority_queue<pair<int,int>,vector<pair<int,int>>,greater<pair<int,int>>> gt_pq;
+    for (int i=0;i<n_b;i++) gt_pq.push(make_pair(gt.rows[i].size(),i));
+    while (!gt_pq.empty()) {
+        pair<int,int> elem=gt_pq.top(); gt_pq.pop();
+        if (gt.eliminated[elem.second]) continue;
+        if (elem.first!=static_cast<int>(gt.rows[elem.second].size())) { // degree has changed since the node was queued
+            gt_pq.push(make_pair(gt.rows[elem.second].size(),elem.second)); continue; }
+        KPS::gt_sparse_iteration(gt,elem.second,factors);
+    }
+    vector<vector<long double>> absprobs(n_b+n_x,vector<long double>(n_x,0.L));
+    for (int a=0;a<n_x;a++) absprobs[n_b+a][a]=1.L;
+    basin.mfpts.assign(n_b+n_x,0.L);
+    for (vector<GT_factor>::reverse_iterator it_fac=factors.rbegin();it_fac!=factors.rend();++it_fac) {
+        if (it_fac->factor==0.L) continue;
+        vector<long double> &probs=absprobs[it_fac->node];
+        long double mfpt=it_fac->tau;
+        for (const pair<int,long double> &elem: it_fac->row) {
+            for (int a=0;a<n_x;a++) probs[a]+=elem.second*absprobs[elem.first][a];
+            mfpt+=elem.second*basin.mfpts[elem.first];
+        }
+        for (long double &prob: probs) prob/=it_fac->factor;
+        basin.mfpts[it_fac->node]=mfpt/it_fac->factor;
+    }
+    basin.mfpts.resize(n_b);
+    basin.exit_probs.resize(n_b);
+    for (int i=0;i<n_b;i++) {
+        long double cum_prob=0.L;
+        for (int a=0;a<n_x;a++) {
+            if (absprobs[i][a]<=0.L) continue;
+            cum_prob+=absprobs[i][a];
+            basin.exit_probs[i].push_back(make_pair(basin.exits[a],cum_prob));
+        }
+    }
+}
+
+/* compute the eigendecomposition of the transition probability matrix Q of the transient (basin) nodes, from which the first
+   passage time distribution for escape from the basin, and the probabilities for absorption at each boundary node after a given
+   number of steps, are obtained for any initial node. Q is similar to the symmetric matrix D^{1/2} Q D^{-1/2}, where D is the
+   diagonal matrix of stationary probabilities, if the Markov chain satisfies detailed balance within the basin */
+void MCAMC::setup_fpta(const Network &ktn, const vector<int> &basin_nodes, \
+                       const vector<vector<pair<int,long double>>> &tmtx, Mcamc_basin &basin) {
+
+    int n_b=basin_nodes.size(), n_x=basin.exits.size();
+    long double pi_max=-numeric_limits<long double>::infinity();
+    for (int pos: basin_nodes) pi_max=max(pi_max,ktn.nodes[pos].pi);
+    basin.sqrt_pi.resize(n_b);
+    for (int i=0;i<n_b;i++) basin.sqrt_pi[i]=exp(0.5L*(ktn.nodes[basin_nodes[i]].pi-pi_max));
+    vector<vector<long double>> smtx(n_b,vector<long double>(n_b,0.L)); // symmetrised transition probability matrix
+    for (int i=0;i<n_b;i++) {
+        smtx[i][i]=ktn.nodes[basin_nodes[i]].t;
+        for (const pair<int,long double> &elem: tmtx[i]) {
+            if (elem.first<n_b) smtx[i][elem.first]+=basin.sqrt_pi[i]*elem.second/basin.sqrt_pi[elem.first]; }
+    }
+    for (int i=0;i<n_b;i++) {
+        for (int j=i+1;j<n_b;j++) {
+            if (abs(smtx[i][j]-smtx[j][i])>1.E-08*max(smtx[i][j],smtx[j][i])) {
+                cout << "mcamc> error: the FPTA method requires that the Markov chain satisfies detailed balance, use MEANRATE" << endl;
+                exit(EXIT_FAILURE); }
+            smtx[i][j]=smtx[j][i]=0.5L*(smtx[i][j]+smtx[j][i]);
+        }
+    }
+    jacobi_eigen(smtx,basin.evals,basin.evecs);
+    basin.surv_coeffs.assign(n_b,0.L);
+    basin.exit_coeffs.assign(n_b,vector<long double>(n_x,0.L));
+    for (int k=0;k<n_b;k++) {
+        for (int j=0;j<n_b;j++) {
+            long double u=basin.evecs[j][k]*basin.sqrt_pi[j];
+            basin.surv_coeffs[k]+=u;
+            for (const pair<int,long double> &elem: tmtx[j]) {
+                if (elem.first>=n_b) basin.exit_coeffs[k][elem.first-n_b]+=u*elem.second; }
+        }
+    }
+}
+
+/* sample the number of steps n of an escape trajectory from node i of a basin, by inversion of the survival probability
+   S_i(n) = (Q^n 1)_i, which is evaluated from the eigendecomposition of Q. The search is by bisection, after doubling n until
+   S_i(n) is less than the random number */
+unsigned long long int MCAMC::sample_nhops(const Mcamc_basin &basin, int i) {
+
+    long double rand_no=Wrapper_Method::rand_unif_met(seed);
+    auto surv_prob = [&basin,i](unsigned long long int n) {
+        long double surv=0.L;
+        for (int k=0;k<static_cast<int>(basin.evals.size());k++) {
+            surv+=basin.evecs[i][k]*pow(basin.evals[k],static_cast<long double>(n))*basin.surv_coeffs[k]; }
+        return surv/basin.sqrt_pi[i];
+    };
+    unsigned long long int n_lo=0, n_hi=1; // S_i(n_lo) > rand_no >= S_i(n_hi)
+    while (surv_prob(n_hi)>rand_no) {
+        n_lo=n_hi; n_hi*=2;
+        if (n_hi>(1ULL<<62)) {
+            cout << "mcamc> error: escape trajectory from basin does not terminate" << endl; exit(EXIT_FAILURE); }
+    }
+    while (n_hi-n_lo>1) {
+        unsigned long long int n_mid=n_lo+(n_hi-n_lo)/2;
+        if (surv_prob(n_mid)>rand_no) { n_lo=n_mid; } else { n_hi=n_mid; }
+    }
+    return n_hi;
+}
+
+/* sample the absorbing boundary node at which an escape trajectory from node i of a basin exits, given that the trajectory is
+   absorbed at the n-th step. The probabilities are proportional to (Q^{n-1} R)_{i,a}, where R is the matrix of transition
+   probabilities from basin nodes to boundary nodes. Returns the position of the boundary node */
+int MCAMC::sample_exit(const Mcamc_basin &basin, int i, unsigned long long int n) {
+
+    vector<long double> coeffs(basin.evals.size());
+    for (int k=0;k<static_cast<int>(basin.evals.size());k++) coeffs[k]=basin.evecs[i][k]*pow(basin.evals[k],static_cast<long double>(n-1));
+    vector<pair<int,long double>> exit_probs;
+    long double cum_prob=0.L;
+    for (int a=0;a<static_cast<int>(basin.exits.size());a++) {
+        long double prob=0.L;
+        for (int k=0;k<static_cast<int>(basin.evals.size());k++) prob+=coeffs[k]*basin.exit_coeffs[k][a];
+        if (prob<=0.L) continue; // negative values can arise only from numerical error
+        cum_prob+=prob;
+        exit_probs.push_back(make_pair(basin.exits[a],cum_prob));
+    }
+    if (exit_probs.empty()) {
+        cout << "mcamc> error: absorption probabilities for escape from basin could not be computed" << endl; exit(EXIT_FAILURE); }
+    return Wrapper_Method::sample_cum_distribn(exit_probs,seed);
+}
+
+/* eigendecomposition of a real symmetric matrix a by the cyclic Jacobi method. The matrix is overwritten, and on return the k-th
+   column of evecs is the eigenvector with eigenvalue evals[k] */
+void MCAMC::jacobi_eigen(vector<vector<long double>> &a, vector<long double> &evals, vector<vector<long double>> &evecs) {
+
+    int n=a.size();
+    evecs.assign(n,vector<long double>(n,0.L));
+    long double norm=0.L;
+    for (int i=0;i<n;i++) {
+        evecs[i][i]=1.L;
+        for (int j=0;j<n;j++) norm+=a[i][j]*a[i][j];
+    }
+    for (int sweep=0;sweep<100;sweep++) {
+        long double off=0.L; // sum of squares of off-diagonal elements
+        for (int p=0;p<n;p++) { for (int q=p+1;q<n;q++) off+=a[p][q]*a[p][q]; }
+        if (off<=1.E-36L*norm) break;
+        for (int p=0;p<n;p++) {
+            for (int q=p+1;q<n;q++) {
+                if (a[p][q]==0.L) continue;
+                long double theta=(a[q][q]-a[p][p])/(2.L*a[p][q]);
+                long double t=(theta>=0.L?1.L:-1.L)/(abs(theta)+sqrt(theta*theta+1.L));
+                long double c=1.L/sqrt(t*t+1.L), s=t*c;
+                for (int k=0;k<n;k++) {
+                    long double a_kp=a[k][p], a_kq=a[k][q];
+                    a[k][p]=c*a_kp-s*a_kq; a[k][q]=s*a_kp+c*a_kq;
+                }
+                for (int k=0;k<n;k++) {
+                    long double a_pk=a[p][k], a_qk=a[q][k];
+                    a[p][k]=c*a_pk-s*a_qk; a[q][k]=s*a_pk+c*a_qk;
+                }
+                for (int k=0;k<n;k++) {
+                    long double v_kp=evecs[k][p], v_kq=evecs[k][q];
+                    evecs[k][p]=c*v_kp-s*v_kq; evecs[k][q]=s*v_kp+c*v_kq;
+                }
+            }
+        }
+    }
+    evals.resize(n);
+    for (int k=0;k<n;k++) evals[k]=a[k][k];
+}
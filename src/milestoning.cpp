@@ -25,12 +25,177 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "kmc_methods.h"
 #include <omp.h>
 #include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cmath>
 
 using namespace std;
 
-MILES::MILES(const Network &ktn, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {}
+/* the milestones are the boundaries between pairs of adjacent communities, and an additional (virtual) milestone is the B set.
+   A trajectory launched from a milestone starts at a node that is the first hitting point of the milestone, i.e. the node to
+   which a transition crossing the boundary leads, sampled in proportion to the equilibrium flux along the crossing transitions.
+   Milestones that are boundaries of the community of the A set are absorbing */
+MILES::MILES(const Network &ktn, int ntrajs, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+
+    this->ntrajs=ntrajs; ncomms=ktn.ncomms;
+    comm_a=(*ktn.nodesA.begin())->comm_id;
+    for (const Node &node: ktn.nodes) {
+        Edge *edgeptr=node.top_from;
+        long double prev_cum_t=node.t;
+        while (edgeptr!=nullptr) {
+            long double t=ktn.accumprobs?edgeptr->t-prev_cum_t:edgeptr->t; // transition probability
+            prev_cum_t=edgeptr->t;
+            const Node *to_node=edgeptr->to_node;
+            if (!edgeptr->deadts && to_node->comm_id!=node.comm_id) {
+                int comm1=min(node.comm_id,to_node->comm_id), comm2=max(node.comm_id,to_node->comm_id);
+                unordered_map<int,int>::iterator it_id=milestone_ids.find(comm1*ncomms+comm2);
+                int m;
+                if (it_id==milestone_ids.end()) {
+                    m=milestones.size(); milestone_ids[comm1*ncomms+comm2]=m;
+                    milestones.push_back(make_pair(comm1,comm2));
+                    absorbing.push_back(comm1==comm_a || comm2==comm_a);
+                    launch_probs.push_back(vector<pair<int,long double>>());
+                } else { m=it_id->second; }
+                long double flux=exp(node.pi)*t/node.t_esc; // equilibrium flux along the edge
+                launch_probs[m].push_back(make_pair(to_node->node_pos, \
+                    (launch_probs[m].empty()?0.L:launch_probs[m].back().second)+flux));
+            }
+            edgeptr=edgeptr->next_from;
+        }
+    }
+    m_b=milestones.size();
+    milestones.push_back(make_pair(-1,-1)); absorbing.push_back(false);
+    int nabsorbing=0;
+    for (bool abs_m: absorbing) { if (abs_m) nabsorbing++; }
+    cout << "miles> setting up milestoning simulation with parameters:\n  no. of milestones: " << milestones.size()-1 \
+         << " \tno. of absorbing milestones: " << nabsorbing << " \tno. of trajectories per milestone: " << ntrajs << endl;
+    if (nabsorbing==0) {
+        cout << "miles> error: the community of the A set is not adjacent to any other community" << endl; exit(EXIT_FAILURE); }
+}
+
 MILES::~MILES() {}
 
+/* ID of the milestone between two communities */
+int MILES::find_milestone(int comm1, int comm2) const {
+    if (comm1>comm2) swap(comm1,comm2);
+    return milestone_ids.at(comm1*ncomms+comm2);
+}
+
+/* main function for milestoning. Each trajectory launched from a (non-absorbing) milestone is a separate task, and is
+   propagated until it crosses a different milestone (recrossings of the milestone from which it was launched are allowed).
+   The tasks for all milestones are independent and are distributed among the threads by the work-stealing scheduler. The random
+   number generator for each trajectory is seeded from the milestone and trajectory IDs, so that the results do not depend on the
+   no. of threads. The milestone transition kernel and the lifetimes of the milestones are then estimated from the trajectories */
 void MILES::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
+    cout << "\n\nmiles> beginning milestoning simulation" << endl;
+    vector<int> sampled_ms; // non-absorbing milestones, from which trajectories are launched
+    for (int m=0;m<static_cast<int>(milestones.size());m++) {
+        if (!absorbing[m]) sampled_ms.push_back(m); }
+    int ntasks=sampled_ms.size()*ntrajs;
+    vector<int> end_ms(ntasks,-1); // milestone hit by each trajectory
+    vector<long double> durations(ntasks,0.L); // time for each trajectory to hit an adjacent milestone
+    Path_scheduler task_scheduler(ntasks,omp_get_max_threads());
+    #pragma omp parallel
+    {
+    Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+    int task_id;
+    while (task_scheduler.next_path(omp_get_thread_num(),task_id)) {
+        int m=sampled_ms[task_id/ntrajs], j=task_id%ntrajs;
+        Walker walker{walker_id:m,path_no:j,k:0,t:0.L,p:-numeric_limits<double>::infinity(),s:0.L};
+        walker.visited.resize(ktn.nbins);
+        Task_rng task_rng(seed,m,j);
+        if (m==m_b) {
+            get_initial_node(ktn,walker,seed);
+        } else {
+            walker.curr_node=&ktn.nodes[sample_cum_distribn(launch_probs[m],seed)]; walker.prev_node=walker.curr_node; }
+        int last_comm=walker.curr_node->comm_id;
+        for (;;) {
+            traj_method_local->kmc_iteration(ktn,walker);
+            if (walker.curr_node->comm_id==last_comm) continue;
+            int m_hit=find_milestone(last_comm,walker.curr_node->comm_id);
+            last_comm=walker.curr_node->comm_id;
+            if (m_hit!=m) { end_ms[task_id]=m_hit; break; }
+        }
+        durations[task_id]=walker.t;
+    }
+    delete traj_method_local;
+    }
+    kernel_counts.assign(milestones.size(),vector<long long int>(milestones.size(),0));
+    lifetimes.assign(milestones.size(),0.L);
+    for (int task_id=0;task_id<ntasks;task_id++) {
+        int m=sampled_ms[task_id/ntrajs];
+        kernel_counts[m][end_ms[task_id]]++;
+        lifetimes[m]+=durations[task_id]/static_cast<long double>(ntrajs);
+    }
+    solve_milestones();
+    ofstream kernel_f; kernel_f.open("miles_kernel.dat");
+    kernel_f.setf(ios::right,ios::adjustfield); kernel_f.setf(ios::scientific,ios::floatfield);
+    kernel_f.precision(10);
+    for (int m: sampled_ms) {
+        for (int m2=0;m2<static_cast<int>(milestones.size());m2++) {
+            if (kernel_counts[m][m2]==0) continue;
+            kernel_f << setw(7) << m << setw(7) << m2 << setw(12) << kernel_counts[m][m2] << setw(20) \
+                     << static_cast<long double>(kernel_counts[m][m2])/static_cast<long double>(ntrajs) << "\n";
+        }
+    }
+    ofstream miles_f; miles_f.open("milestones.dat");
+    miles_f.setf(ios::right,ios::adjustfield); miles_f.setf(ios::scientific,ios::floatfield);
+    miles_f.precision(10);
+    long double tot_flux=0.L;
+    for (long double flux: stat_flux) tot_flux+=flux;
+    for (int m=0;m<static_cast<int>(milestones.size());m++) {
+        miles_f << setw(7) << m << setw(7) << milestones[m].first << setw(7) << milestones[m].second << setw(20) << lifetimes[m] \
+                << setw(20) << stat_flux[m]/tot_flux << setw(20) << mfpts[m] << "\n";
+    }
+    long double tot_time=0.L; // mean time between successive crossings of milestones at steady state
+    for (int m=0;m<static_cast<int>(milestones.size());m++) tot_time+=stat_flux[m]*lifetimes[m];
+    cout << "miles> finished milestoning simulation. " << ntasks << " trajectories were simulated" << endl;
+    cout << "miles> estimated A<-B MFPT: " << mfpts[m_b] << "  rate constant (steady state flux into A): " \
+         << stat_flux[m_b]/tot_time << endl;
+}
+
+/* compute the stationary flux through the milestones (by the GTH algorithm) for the Markov chain where trajectories that hit an
+   absorbing milestone are recycled to the B set, and the mean first passage times to the A set, which satisfy (I-K)T=tau (where
+   K is the milestone transition kernel and tau the vector of lifetimes), by Gaussian elimination with partial pivoting. The
+   B milestone is the first state of the Markov chain so that it is the reference state for the GTH algorithm */
+void MILES::solve_milestones() {
+
+    int n=milestones.size();
+    vector<int> order(n); // order of milestones in the Markov chain
+    order[0]=m_b;
+    for (int m=0;m<m_b;m++) order[m+1]=m;
+    vector<vector<long double>> tmtx(n,vector<long double>(n,0.L));
+    for (int i=0;i<n;i++) {
+        if (absorbing[order[i]]) { tmtx[i][0]=1.L; continue; }
+        for (int j=0;j<n;j++) tmtx[i][j]=static_cast<long double>(kernel_counts[order[i]][order[j]])/static_cast<long double>(ntrajs);
+    }
+    vector<long double> nu=calc_stat_distribn(tmtx);
+    stat_flux.assign(n,0.L);
+    for (int i=0;i<n;i++) stat_flux[order[i]]=nu[i];
+    vector<vector<long double>> amtx(n,vector<long double>(n+1,0.L)); // augmented matrix of the linear system
+    for (int m=0;m<n;m++) {
+        amtx[m][m]=1.L;
+        if (absorbing[m]) continue;
+        for (int m2=0;m2<n;m2++) amtx[m][m2]-=static_cast<long double>(kernel_counts[m][m2])/static_cast<long double>(ntrajs);
+        amtx[m][n]=lifetimes[m];
+    }
+    for (int i=0;i<n;i++) {
+        int p=i;
+        for (int j=i+1;j<n;j++) { if (abs(amtx[j][i])>abs(amtx[p][i])) p=j; }
+        swap(amtx[i],amtx[p]);
+        if (amtx[i][i]==0.L) {
+            cout << "miles> error: the A set cannot be reached from all milestones" << endl; exit(EXIT_FAILURE); }
+        for (int j=i+1;j<n;j++) {
+            long double f=amtx[j][i]/amtx[i][i];
+            if (f==0.L) continue;
+            for (int k=i;k<=n;k++) amtx[j][k]-=f*amtx[i][k];
+        }
+    }
+    mfpts.assign(n,0.L);
+    for (int i=n-1;i>=0;i--) {
+        long double x=amtx[i][n];
+        for (int j=i+1;j<n;j++) x-=amtx[i][j]*mfpts[j];
+        mfpts[i]=x/amtx[i][i];
+    }
 }
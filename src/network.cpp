@@ -21,6 +21,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "network.h"
 #include <vector>
 #include <queue>
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <iostream>
@@ -94,6 +95,7 @@ void Network::dumpwaittimes() {
 void Network::get_tmtx_lin(long double tau) {
     cout << "network> calculating linearised transition probability matrix at lag time: " << tau << endl;
     for (auto &node: nodes) {
+        calc_t_esc(node);
         if (tau>node.t_esc) throw Network_exception(); // value of tau does not give stochastic matrix
         node.t = 1.L-(tau/node.t_esc);
         node.t_esc = tau; // mean waiting times are all equal in the linearised transition matrix
@@ -353,6 +355,75 @@ void Network::set_initcond(const vector<double> &init_probs) {
     this->init_probs=init_probs;
 }
 
+/* find the strongly connected components (SCCs) of the directed graph of transitions with nonzero probability, using an iterative
+   implementation of Tarjan's algorithm. The SCC IDs are assigned in reverse topological order, i.e. an SCC from which no other
+   SCC can be reached has the lowest ID */
+void Network::find_sccs() {
+
+    scc_ids.assign(n_nodes,-1); n_sccs=0;
+    vector<int> idx(n_nodes,-1), lowlink(n_nodes); // index of node in order of discovery, and lowest index reachable
+    vector<bool> onstack(n_nodes,false);
+    vector<int> scc_stack; // stack of nodes that have been visited but not yet assigned to an SCC
+    vector<pair<int,const Edge*>> dfs_stack; // stack for the depth-first search, with next edge to be traversed for each node
+    int n_visited=0;
+    for (int i=0;i<n_nodes;i++) {
+        if (idx[i]>=0) continue;
+        dfs_stack.push_back(make_pair(i,nodes[i].top_from));
+        idx[i]=n_visited; lowlink[i]=n_visited; n_visited++;
+        scc_stack.push_back(i); onstack[i]=true;
+        while (!dfs_stack.empty()) {
+            int j=dfs_stack.back().first;
+            const Edge *edgeptr=dfs_stack.back().second;
+            while (edgeptr!=nullptr && (edgeptr->deadts || !(edgeptr->t>0.L))) edgeptr=edgeptr->next_from;
+            if (edgeptr!=nullptr) { // traverse edge
+                dfs_stack.back().second=edgeptr->next_from;
+                int l=edgeptr->to_node->node_pos;
+                if (idx[l]<0) {
+                    idx[l]=n_visited; lowlink[l]=n_visited; n_visited++;
+                    scc_stack.push_back(l); onstack[l]=true;
+                    dfs_stack.push_back(make_pair(l,nodes[l].top_from));
+                } else if (onstack[l]) {
+                    lowlink[j]=min(lowlink[j],idx[l]);
+                }
+                continue;
+            }
+            // all edges from the node have been traversed
+            dfs_stack.pop_back();
+            if (!dfs_stack.empty()) lowlink[dfs_stack.back().first]=min(lowlink[dfs_stack.back().first],lowlink[j]);
+            if (lowlink[j]==idx[j]) { // node is the root of an SCC
+                int l;
+                do {
+                    l=scc_stack.back(); scc_stack.pop_back(); onstack[l]=false;
+                    scc_ids[l]=n_sccs;
+                } while (l!=j);
+                n_sccs++;
+            }
+        }
+    }
+}
+
+/* find the nodes that can be reached from (if fwd), or that can reach (if !fwd), any node in the set of nodes srcnodes, by
+   breadth-first search along transitions with nonzero probability. Nodes in the set stopnodes are flagged if they are reached,
+   but the search does not continue from these nodes */
+vector<bool> Network::get_reachable(const set<const Node*> &srcnodes, bool fwd, const set<const Node*> &stopnodes) const {
+
+    vector<bool> reached(n_nodes,false);
+    queue<int> nbr_queue;
+    for (const Node *nodeptr: srcnodes) { reached[nodeptr->node_pos]=true; nbr_queue.push(nodeptr->node_pos); }
+    while (!nbr_queue.empty()) {
+        int i=nbr_queue.front(); nbr_queue.pop();
+        if (!srcnodes.count(&nodes[i]) && stopnodes.count(&nodes[i])) continue;
+        const Edge *edgeptr=fwd?nodes[i].top_from:nodes[i].top_to;
+        while (edgeptr!=nullptr) {
+            const Node *nbr_node=fwd?edgeptr->to_node:edgeptr->from_node;
+            if (!edgeptr->deadts && edgeptr->t>0.L && !reached[nbr_node->node_pos]) {
+                reached[nbr_node->node_pos]=true; nbr_queue.push(nbr_node->node_pos); }
+            edgeptr=fwd?edgeptr->next_from:edgeptr->next_to;
+        }
+    }
+    return reached;
+}
+
 /* update the Network object pointed to by the ktn argument to include an additional edge (with index k in the edges vector)
    connecting from_node and to_node */
 void Network::add_edge_network(Network *ktn, Node &from_node, Node &to_node, int k) {
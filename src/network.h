@@ -127,6 +127,8 @@ struct Network {
     void set_accumprobs(); // set transition probabilities to accumulated branching probability values (for optimisation in kMC)
     void renormalize_selfloops(); // (for a DTMC) renormalize escape (lag) times and outgoing transition probs to subsume self-loops
     void set_initcond(const vector<double>&); // set initial probabilities for nodes in set B
+    void find_sccs(); // find the strongly connected components of the network (Tarjan's algorithm)
+    vector<bool> get_reachable(const set<const Node*>&,bool,const set<const Node*>& = {}) const; // find nodes connected to a set
     static void add_edge_network(Network*,Node&,Node&,int);
     static void setup_network(Network&,const vector<pair<int,int>>&,const vector<pair<long double,long double>>&, \
         const vector<long double>&,const vector<int>&,const vector<int>&,bool,bool,bool,long double,int,const vector<int>& = {}, \
@@ -147,6 +149,8 @@ struct Network {
     set<const Node*> nodesA, nodesB; // A and B endpoint nodes (A<-B)
     vector<double> init_probs; // initial probabilities for nodes in B
     vector<int> comm_sizes; // number of nodes in each community
+    vector<int> scc_ids; // IDs of the strongly connected components to which nodes belong
+    int n_sccs=0; // number of strongly connected components (the Markov chain is irreducible if this is equal to one)
     bool branchprobs=false; // transition probabilities of Edges are branching probabilities (Y/N)
     bool accumprobs=false; // transition probabilities are accumulated values (Y/N)
     bool initcond=false; // nodes in set B have initial probabilities different to their equilibrium values (Y/N)
@@ -25,12 +25,196 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "kmc_methods.h"
+#include <omp.h>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 
-NEUS::NEUS(const Network &ktn, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {}
+/* the windows are the communities. Initially, the walkers of each window are at nodes sampled from the equilibrium distribution
+   within the window, and all windows (except that of A, in which walkers are not simulated) have equal weights */
+NEUS::NEUS(const Network &ktn, int nwinwalkers, double taure, bool discretetime, \
+           const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+
+    cout << "neus> setting up NEUS-kMC simulation with parameters:\n  time between updates of window weights: " << taure \
+         << " \tno. of windows: " << ktn.ncomms << " \tno. of walkers per window: " << nwinwalkers << endl;
+    this->nwinwalkers=nwinwalkers; this->taure=taure; this->discretetime=discretetime;
+    comm_a=(*ktn.nodesA.begin())->comm_id;
+    /* no walkers are simulated in the window of A, so excursions must not end at nodes of this window that are not in A */
+    for (const Node &node: ktn.nodes) {
+        if ((node.comm_id==comm_a)!=(node.aorb==-1)) {
+            cout << "neus> error: the nodes of the A set must constitute a single community" << endl; exit(EXIT_FAILURE); }
+    }
+    win_walkers.resize(ktn.ncomms); walker_entries.resize(ktn.ncomms);
+    win_weights.assign(ktn.ncomms,0.L); win_times.assign(ktn.ncomms,0.L);
+    entry_stats.resize(ktn.ncomms); entry_probs.resize(ktn.ncomms); init_probs.resize(ktn.ncomms);
+    vector<long double> win_pi(ktn.ncomms,0.L);
+    for (const Node &node: ktn.nodes) {
+        win_pi[node.comm_id]+=exp(node.pi);
+        init_probs[node.comm_id].push_back(make_pair(node.node_pos,win_pi[node.comm_id]));
+    }
+    int nwins=0;
+    for (int i=0;i<ktn.ncomms;i++) {
+        if (i!=comm_a && !init_probs[i].empty()) nwins++; }
+    for (int i=0;i<ktn.ncomms;i++) {
+        if (i==comm_a || init_probs[i].empty()) continue;
+        win_weights[i]=1.L/static_cast<long double>(nwins);
+        win_walkers[i].resize(nwinwalkers);
+        walker_entries[i].resize(nwinwalkers);
+        for (int j=0;j<nwinwalkers;j++) {
+            Walker &walker=win_walkers[i][j];
+            walker={walker_id:i,path_no:j,k:0,t:0.L,p:-numeric_limits<double>::infinity(),s:0.L};
+            walker.visited.resize(ktn.nbins);
+            Task_rng task_rng(seed,-1-i,j);
+            walker_entries[i][j].first=sample_cum_distribn(init_probs[i],seed);
+            walker.curr_node=&ktn.nodes[walker_entries[i][j].first]; walker.prev_node=walker.curr_node;
+        }
+    }
+}
+
 NEUS::~NEUS() {}
 
+/* main loop of NEUS-kMC. In each iteration, the walkers of all windows are propagated in parallel until the next update time.
+   A walker that leaves its window (an excursion) is restarted from an entry point of its own window, sampled in proportion to
+   the estimated steady state flux into the entry points (walkers that reach A are recycled to B). The window weights, the flux
+   into the entry points, and the A<-B rate constant (the steady state flux into A) are then updated */
 void NEUS::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
+    cout << "\n\nneus> beginning NEUS-kMC simulation" << endl;
+    n_ab=0; int n_neusit=0;
+    long double tau_r=static_cast<long double>(taure); // next time at which the window weights are updated
+    ofstream rates_f; rates_f.open("neus_rates.dat");
+    rates_f.setf(ios::right,ios::adjustfield); rates_f.setf(ios::scientific,ios::floatfield);
+    rates_f.precision(10);
+    while ((n_ab<nabpaths) and (n_neusit<maxit)) {
+        vector<long double> times(ktn.ncomms,0.L); // time simulated in each window in this iteration
+        vector<int> n_hits(ktn.ncomms,0); // no. of walkers of each window that reached A in this iteration
+        #pragma omp parallel
+        {
+        Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+        #pragma omp for schedule(dynamic)
+        for (int i=0;i<ktn.ncomms;i++) {
+            if (win_walkers[i].empty()) continue;
+            propagate_window(ktn,traj_method_local,i,n_neusit,tau_r,times[i],n_hits[i]);
+        }
+        delete traj_method_local;
+        }
+        int n_ab_it=0;
+        for (int i=0;i<ktn.ncomms;i++) { win_times[i]+=times[i]; n_ab_it+=n_hits[i]; }
+        n_ab+=n_ab_it;
+        update_weights(ktn);
+        rates_f << setw(10) << n_neusit << setw(20) << tau_r << setw(10) << n_ab_it << setw(20) << k_ab << "\n";
+        if (debug) cout << "neus> iteration " << n_neusit << " time: " << tau_r << " walkers reached A: " << n_ab_it \
+                        << " rate constant: " << k_ab << endl;
+        n_neusit++;
+        tau_r += taure;
+    }
+    ofstream weights_f; weights_f.open("neus_weights.dat");
+    weights_f.setf(ios::right,ios::adjustfield); weights_f.setf(ios::scientific,ios::floatfield);
+    weights_f.precision(10);
+    for (int i=0;i<ktn.ncomms;i++) {
+        long long int n_exc=0;
+        for (const pair<const int,Neus_entry_stats> &stats: entry_stats[i]) n_exc+=stats.second.n_exc;
+        weights_f << setw(7) << i << setw(20) << win_weights[i] << setw(20) << win_times[i] << setw(14) << n_exc << "\n";
+    }
+    cout << "neus> finished NEUS-kMC simulation after " << n_neusit << " iterations. " << n_ab << " walkers reached A" << endl;
+    cout << "neus> estimated A<-B rate constant (steady state flux into A): " << k_ab << endl;
+}
+
+/* propagate the walkers confined to a window until the update time, recording the statistics of the excursions from the entry
+   points of the window (or, initially, from the nodes at which the walkers were initialised). Each walker has its own random
+   number generator, so that the simulation does not depend on the no. of threads */
+void NEUS::propagate_window(const Network &ktn, Traj_Method *traj_method_obj, int win, int n_neusit, long double tau_r, \
+                            long double &win_time, int &n_hits) {
+
+    unordered_map<int,Neus_entry_stats> &win_stats=entry_stats[win];
+    for (int j=0;j<static_cast<int>(win_walkers[win].size());j++) {
+        Walker &walker=win_walkers[win][j];
+        pair<int,long double> &entry=walker_entries[win][j];
+        Task_rng task_rng(seed,n_neusit,win*nwinwalkers+j);
+        long double t_start=walker.t;
+        while (walker.t<tau_r) {
+            const Node *prev_node=walker.prev_node, *curr_node=walker.curr_node;
+            unsigned long long int k=walker.k; long double p=walker.p, s=walker.s;
+            traj_method_obj->kmc_iteration(ktn,walker);
+            if (!discretetime && walker.t>tau_r) { // the waiting time distribution is memoryless, so the step can be discarded
+                walker.prev_node=prev_node; walker.curr_node=curr_node; walker.k=k; walker.p=p; walker.s=s;
+                walker.t=tau_r;
+                break;
+            }
+            if (walker.curr_node->comm_id==win) continue;
+            bool hit_a=walker.curr_node->aorb==-1;
+            if (hit_a) { get_initial_node(ktn,walker,seed); n_hits++; } // the walker is recycled to B
+            Neus_entry_stats &stats=win_stats[entry.first];
+            stats.n_exc++; stats.tot_time+=walker.t-entry.second;
+            stats.exits[walker.curr_node->node_pos]++;
+            if (hit_a) stats.n_a++;
+            // if there is no estimate of the flux into the window yet, the walker is restarted from the equilibrium distribution
+            entry.first=sample_cum_distribn(entry_probs[win].empty()?init_probs[win]:entry_probs[win],seed);
+            entry.second=walker.t;
+            walker.curr_node=&ktn.nodes[entry.first]; walker.prev_node=walker.curr_node;
+        }
+        win_time+=walker.t-t_start;
+    }
+}
+
+/* the sequence of entry points visited by a walker that is not confined to a window is a Markov chain. Its transition
+   probabilities and the mean times of the excursions from the entry points are estimated from the completed excursions, which
+   do not depend on the distribution from which the walkers were restarted, so that the estimates are not biased by the window
+   weights of previous iterations. The stationary distribution of the Markov chain (computed by the GTH algorithm), weighted by
+   the mean excursion times, yields the steady state weights of the windows and the A<-B rate constant. Entry points from which
+   no excursion has been completed, and the initial nodes of walkers that are not entry points, are excluded */
+void NEUS::update_weights(const Network &ktn) {
+
+    unordered_map<int,bool> is_entry; // nodes at which excursions have ended
+    for (const unordered_map<int,Neus_entry_stats> &win_stats: entry_stats) {
+        for (const pair<const int,Neus_entry_stats> &stats: win_stats) {
+            for (const pair<const int,long long int> &exit: stats.second.exits) is_entry[exit.first]=true; }
+    }
+    vector<pair<int,const Neus_entry_stats*>> states; // entry points with completed excursions, sorted by node ID
+    for (const unordered_map<int,Neus_entry_stats> &win_stats: entry_stats) {
+        for (const pair<const int,Neus_entry_stats> &stats: win_stats) {
+            if (stats.second.n_exc>0 && is_entry.count(stats.first)) states.push_back(make_pair(stats.first,&stats.second)); }
+    }
+    if (states.empty()) return;
+    sort(states.begin(),states.end(),[](const pair<int,const Neus_entry_stats*> &a, const pair<int,const Neus_entry_stats*> &b) {
+        return a.first<b.first; });
+    int m=states.size();
+    unordered_map<int,int> state_ids;
+    for (int i=0;i<m;i++) state_ids[states[i].first]=i;
+    vector<vector<long double>> tmtx(m,vector<long double>(m,0.L));
+    for (int i=0;i<m;i++) {
+        long long int n_known=0; // no. of excursions that ended at entry points from which excursions have been completed
+        for (const pair<const int,long long int> &exit: states[i].second->exits) {
+            unordered_map<int,int>::const_iterator it_id = state_ids.find(exit.first);
+            if (it_id==state_ids.end()) continue;
+            tmtx[i][it_id->second]+=static_cast<long double>(exit.second); n_known+=exit.second;
+        }
+        if (n_known>0) { for (long double &t: tmtx[i]) t/=static_cast<long double>(n_known); }
+    }
+    vector<long double> nu = calc_stat_distribn(tmtx); // stationary distribution of the Markov chain of entry points
+    long double tot_time=0.L, flux_a=0.L;
+    vector<long double> weights(win_weights.size(),0.L);
+    vector<unordered_map<int,long double>> entry_fluxes(win_weights.size());
+    for (int i=0;i<m;i++) {
+        const Neus_entry_stats &stats=*states[i].second;
+        long double n_exc=static_cast<long double>(stats.n_exc);
+        weights[ktn.nodes[states[i].first].comm_id]+=nu[i]*stats.tot_time/n_exc; tot_time+=nu[i]*stats.tot_time/n_exc;
+        flux_a+=nu[i]*static_cast<long double>(stats.n_a)/n_exc;
+        // flux into entry points (including those from which no excursion has been completed)
+        for (const pair<const int,long long int> &exit: stats.exits) {
+            entry_fluxes[ktn.nodes[exit.first].comm_id][exit.first]+=nu[i]*static_cast<long double>(exit.second)/n_exc; }
+    }
+    if (tot_time==0.L) return;
+    for (int i=0;i<static_cast<int>(win_weights.size());i++) win_weights[i]=weights[i]/tot_time;
+    k_ab=flux_a/tot_time;
+    for (int i=0;i<static_cast<int>(win_weights.size());i++) { // entry points are sorted by node ID, so that the sampling does not depend on the hash map
+        entry_probs[i].assign(entry_fluxes[i].begin(),entry_fluxes[i].end());
+        sort(entry_probs[i].begin(),entry_probs[i].end());
+        for (int j=1;j<static_cast<int>(entry_probs[i].size());j++) entry_probs[i][j].second+=entry_probs[i][j-1].second;
+        if (!entry_probs[i].empty() && entry_probs[i].back().second==0.L) entry_probs[i].clear();
+    }
 }
@@ -1,7 +1,9 @@
 /*
 File containing functions relating to the recursive enumeration algorithm (REA) for the k shortest paths problem.
 
-Here the REA is used to determine the k first passage A<-B paths of the Markov chain with the highest probability. See:
+Here the REA is used to determine the k first passage A<-B paths of the Markov chain with the highest probability. Multiple
+source and sink nodes are treated by a virtual super-source, with transitions to the source nodes weighted by their initial
+occupation probabilities, and a virtual super-sink, with transitions from all sink nodes. See:
 V. M. Jimenez and A. Marzal: "Computing the k shortest paths: a new algorithm and experimental comparison," in Algorithm Engineering:
 3rd International Workshop, WAE '99, London, UK, ed. J. S. Vitter and C. D. Zaroliagis (Springer Berlin, Heidelberg, 1999) pp. 15-29.
 
@@ -24,97 +26,264 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "kmc_methods.h"
 #include <cmath>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <tuple>
 #include <iostream>
 
 using namespace std;
 
 /* constructor for REA derived class */
-REA::REA(const Network &ktn, bool discretetime, bool writerea, bool reanotirred, \
+REA::REA(const Network &ktn, bool discretetime, bool writerea, bool reanotirred, double deltastep, \
 	 const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
 
     cout << "\n\nrea> using the REA to determine the " << wrapper_args.nabpaths << " highest-probability paths" << endl;
     this->discretetime=discretetime;
-    this->writerea=writerea; this->reanotirred=reanotirred;
-    if (reanotirred) { // maintain list of values to indicate nodes for which no more candidate paths exist
+    this->writerea=writerea; this->reanotirred=reanotirred; this->deltastep=deltastep;
+    if (!reanotirred && ktn.n_sccs>1) { // the set of shortest paths to some nodes may be finite
+        cout << "rea> the Markov chain is reducible, the number of paths to the target node may be finite" << endl;
+        this->reanotirred=true; }
+    if (this->reanotirred) { // maintain list of values to indicate nodes for which no more candidate paths exist
         nomorecands.resize(ktn.n_nodes);
 	fill(nomorecands.begin(),nomorecands.end(),false);
     }
-    source_node = *ktn.nodesB.begin(); // NB there is only a single source node
-    sink_node = *ktn.nodesA.begin(); // NB there is only a single sink node
-    shortest_paths.resize(ktn.n_nodes); candidate_paths.resize(ktn.n_nodes);
-    for (int i=0;i<ktn.n_nodes;i++) { // allocate arrays for candidate and assigned shortest paths
-        shortest_paths[i].resize(wrapper_args.nabpaths);
-        for (int k=1;k<wrapper_args.nabpaths+1;k++) { // path cost is initially infinite and predecessor node not set for all paths
-            /* for the REA Wrapper_Method, the members of the Walker objects are interpreted as follows:
-               the [path_no]-th shortest path to curr_node, for which the path length/time/action/entropy are stored in members k/t/p/s,
-               is the union of:    { [walker_id]-th shortest path to node prev_node } \cup curr_node
-               and is stored as the element:    shortest_paths[curr_node->node_id-1][path_no-1] */
-            shortest_paths[i][k-1] = { walker_id:0,path_no:k,k:0,t:0.L, \
-                                       p:numeric_limits<long double>::infinity(),s:0.L,prev_node:nullptr,curr_node:&ktn.nodes[i] };
-        }
-        candidate_paths[i].resize(ktn.nodes[i].udeg); // edges are bidirectional, so in- and out-degrees of nodes are the same
-        for (int j=0;j<ktn.nodes[i].udeg;j++) {
-            candidate_paths[i][j].first=nullptr; candidate_paths[i][j].second=nullptr;
-        }
+    source_costs=Wrapper_Method::get_source_costs(ktn);
+    if (ktn.nodesB.size()>1 || ktn.nodesA.size()>1) {
+        cout << "rea> paths start from a super-source connected to " << ktn.nodesB.size() << " source nodes and end at a super-sink" \
+             << " connected to " << ktn.nodesA.size() << " sink nodes" << endl; }
+    /* nodes that cannot be reached from the source node without passing through the sink node, or from which the sink node
+       cannot be reached, do not lie on any first passage path and are pruned */
+    vector<bool> fromsource=ktn.get_reachable(ktn.nodesB,true,ktn.nodesA), tosink=ktn.get_reachable(ktn.nodesA,false);
+    pruned.resize(ktn.n_nodes); int n_pruned=0;
+    for (int i=0;i<ktn.n_nodes;i++) {
+        pruned[i]=!(fromsource[i] && tosink[i]);
+        if (pruned[i]) n_pruned++;
     }
+    if (all_of(ktn.nodesA.begin(),ktn.nodesA.end(),[&](const Node *node_a) { return pruned[node_a->node_id-1]; })) {
+        cout << "rea> error: the target node cannot be reached from the initial node" << endl; exit(EXIT_FAILURE); }
+    cout << "rea> pruned " << n_pruned << " nodes that do not lie on any first passage path" << endl;
+    /* the arrays of shortest paths and of candidate paths for each node are empty initially, and grow as paths are found */
+    shortest_paths.resize(ktn.n_nodes); candidate_paths.resize(ktn.n_nodes);
 }
 
 REA::~REA() {}
 
 void REA::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
-    int nspaths = nabpaths; // number of shortest paths computed
-    dijkstra(ktn); // find shortest (i.e. highest-probability) path
-    for (int k=2;k<nabpaths+1;k++) { // main loop of REA
-        next_path(*sink_node,k);
-	if (reanotirred && nomorecands[sink_node->node_id-1]) { // complete set of paths to target node found at previous iteration; exit REA loop
-            cout << "rea> all " << k-1 << " paths to the target node have been found, exiting REA loop" << endl;
-	    nspaths=k-1; break;
-	}
+    if (deltastep<0.) { dijkstra(ktn); // find shortest (i.e. highest-probability) path
+    } else { deltastepping(ktn); } // find shortest path tree in parallel
+    /* the k-th shortest path to the super-sink is the best of the next shortest paths to each of the sink nodes that have not yet
+       been selected. These are kept in a binary heap, ordered by path cost (ties are broken by node ID) */
+    priority_queue<tuple<double,int,int>,vector<tuple<double,int,int>>,greater<tuple<double,int,int>>> sink_pq;
+    for (const Node *node_a: ktn.nodesA) {
+        if (!shortest_paths[node_a->node_id-1].empty()) {
+            sink_pq.push(make_tuple(shortest_paths[node_a->node_id-1][0].p,node_a->node_id-1,1)); }
     }
-    for (int k=1;k<nspaths+1;k++) shortest_paths[sink_node->node_id-1][k-1].dump_fpp_properties();
-    if (writerea) print_shortest_paths(nspaths); // print the k shortest paths (or total number determined) to the sink node
+    vector<pair<int,int>> sink_paths; // sink node and rank of the shortest path to that node for the k shortest paths
+    while (!sink_pq.empty()) { // main loop of REA
+        int a=get<1>(sink_pq.top()), ka=get<2>(sink_pq.top()); sink_pq.pop();
+        sink_paths.push_back(make_pair(a,ka));
+        if (static_cast<int>(sink_paths.size())==nabpaths) break;
+        next_path(ktn.nodes[a],ka+1);
+        if (static_cast<int>(shortest_paths[a].size())>ka) sink_pq.push(make_tuple(shortest_paths[a][ka].p,a,ka+1));
+    }
+    if (static_cast<int>(sink_paths.size())<nabpaths) { // complete set of paths to target node found; exit REA loop
+        cout << "rea> all " << sink_paths.size() << " paths to the target node have been found, exiting REA loop" << endl; }
+    for (int k=1;k<static_cast<int>(sink_paths.size())+1;k++) {
+        const REA_path &path = shortest_paths[sink_paths[k-1].first][sink_paths[k-1].second-1];
+        Walker walker{walker_id:0,path_no:k,k:path.k,t:path.t,p:path.p,s:path.s};
+        walker.dump_fpp_properties();
+    }
+    if (writerea) print_shortest_paths(ktn,sink_paths); // print the k shortest paths (or total number determined) to the sink node
 }
 
-/* compute the first shortest path from the source node to all other nodes using Dijkstra's algorithm */
+/* compute the first shortest path from the super-source to all other nodes using Dijkstra's algorithm. The node with the current
+   lowest shortest path cost is found from a binary heap, in which entries are not updated when the path cost to a node decreases,
+   but are instead discarded when popped if the node is already in the shortest path tree (lazy deletion). If only the first
+   shortest path is required, the algorithm terminates when a sink node is added to the shortest path tree */
 void REA::dijkstra(const Network& ktn) {
     if (debug) cout << "\nDijkstra's algorithm" << endl;
     vector<bool> insptree(ktn.n_nodes,false); // vector for bookkeeping which nodes have been incorporated into the shortest path tree
+    priority_queue<pair<double,int>,vector<pair<double,int>>,greater<pair<double,int>>> dijkstra_pq;
     // initialisation
-    const Node *curr_node=source_node;
-    shortest_paths[curr_node->node_id-1][0].p=0.L;
+    for (const Node *node_b: ktn.nodesB) { // paths to source nodes via virtual transitions from the super-source
+        int b=node_b->node_id-1;
+        if (pruned[b] || source_costs[b]==numeric_limits<double>::infinity()) continue;
+        shortest_paths[b].push_back({p:source_costs[b],t:0.,s:0.,pred_node:-1,pred_rank:0,k:0});
+        dijkstra_pq.push(make_pair(source_costs[b],b));
+    }
     // main loop for Dijkstra's algorithm
-    for (int i=0;i<ktn.n_nodes;i++) {
-	if (debug) cout << "iter: " << i+1 << "    curr_node: " << curr_node->node_id << endl;
+    int i=0;
+    while (!dijkstra_pq.empty()) {
+        // find node with current lowest shortest path cost
+        int n=dijkstra_pq.top().second; dijkstra_pq.pop();
+        if (insptree[n]) continue; // stale entry of the heap
+        const Node *curr_node=&ktn.nodes[n];
+        insptree[n]=true; i++;
+        if (debug) cout << "iter: " << i << "    curr_node: " << curr_node->node_id << endl;
+        if (curr_node->aorb==-1) { // a sink node cannot be a predecessor of any other node in the shortest path tree
+            if (nabpaths==1) break; // the shortest path to the super-sink has been found, and no other paths are required
+            continue;
+        }
+        const REA_path &curr_path = shortest_paths[n][0];
         const Edge *edgeptr=curr_node->top_from;
-        int n=curr_node->node_id-1;
-        insptree[n]=true;
-	if (*curr_node==*sink_node) goto find_next_node; // sink_node cannot be a predecessor of any other node in the shortest path tree, skip
         while (edgeptr!=nullptr) { // loop over outgoing edges
             int m=edgeptr->to_node->node_id-1;
-            if (shortest_paths[n][0].p - 1.L*log(edgeptr->t) < shortest_paths[m][0].p) {
-                // update path values
-                shortest_paths[m][0].p = shortest_paths[n][0].p - 1.L*log(edgeptr->t);
-                shortest_paths[m][0].k = shortest_paths[n][0].k + 1;
-                shortest_paths[m][0].t = shortest_paths[n][0].t + edgeptr->from_node->t_esc;
-                if (!discretetime) shortest_paths[m][0].s = shortest_paths[n][0].s + (edgeptr->rev_edge->k-edgeptr->k);
-                shortest_paths[m][0].prev_node = curr_node; // set previous node in shortest path tree
-                shortest_paths[m][0].walker_id = 1;
-		if (debug) {
-		    cout << "  curr_node is now pred for node: " << m+1 << "    path cost: " << shortest_paths[m][0].p << endl;
-		}
+            if (pruned[m] || insptree[m] || edgeptr->t<=0.L) { edgeptr=edgeptr->next_from; continue; }
+            double cost = curr_path.p - static_cast<double>(log(edgeptr->t));
+            if (shortest_paths[m].empty() || cost < shortest_paths[m][0].p) {
+                // update path values, and set current node as previous node in shortest path tree
+                REA_path path{p:cost,t:curr_path.t+static_cast<double>(edgeptr->from_node->t_esc),s:curr_path.s, \
+                              pred_node:n,pred_rank:1,k:curr_path.k+1};
+                if (!discretetime) path.s += static_cast<double>(edgeptr->rev_edge->k-edgeptr->k);
+                if (shortest_paths[m].empty()) { shortest_paths[m].push_back(path);
+                } else { shortest_paths[m][0]=path; }
+                dijkstra_pq.push(make_pair(cost,m));
+                if (debug) {
+                    cout << "  curr_node is now pred for node: " << m+1 << "    path cost: " << cost << endl;
+                }
             }
             edgeptr=edgeptr->next_from;
         }
-        find_next_node: {}
-        // find node with current lowest shortest path cost
-        long double mincost=numeric_limits<long double>::infinity();
-        for (int j=0;j<ktn.n_nodes;j++) {
-            if (!insptree[j] && (shortest_paths[j][0].p < mincost)) {
-                mincost = shortest_paths[j][0].p;
-                curr_node = &ktn.nodes[j];
+    }
+}
+
+/* compute the first shortest path from the source node to all other nodes using the parallel Delta-stepping algorithm, see:
+   U. Meyer and P. Sanders, "Delta-stepping: a parallelizable shortest path algorithm," J. Algorithms 49, 114-152 (2003).
+   Nodes are kept in buckets of width Delta according to their tentative path costs. The nodes of the lowest nonempty bucket are
+   removed together, and the outgoing light edges (with cost <= Delta) are relaxed in parallel, repeatedly until the bucket is
+   empty. Then the outgoing heavy edges of all nodes removed from the bucket are relaxed. Relaxation requests are generated by
+   all threads and are sorted by target node into lists owned by each thread, so that each tentative path cost is updated by
+   only one thread. The path costs (action) for all settled nodes are written to the file "path_action.dat", and the shortest path
+   tree is used to initialise the arrays of shortest paths for the REA */
+void REA::deltastepping(const Network &ktn) {
+    struct Relax_request {
+        int node;          // node to which the path cost is to be relaxed
+        double cost;       // cost of the path to the node via the edge
+        bool zerocost;     // the edge has zero cost
+        const Edge *edge;  // edge from the predecessor node
+    };
+    double delta=deltastep;
+    if (delta<=0.) { // by default, the bucket width is the mean cost of edges that are not pruned
+        double tot_cost=0.; long long int n_costs=0;
+        for (const Edge &edge: ktn.edges) {
+            if (edge.deadts || edge.t<=0.L || pruned[edge.from_node->node_id-1] || pruned[edge.to_node->node_id-1]) continue;
+            tot_cost-=static_cast<double>(log(edge.t)); n_costs++;
+        }
+        delta=(n_costs>0 && tot_cost>0.)?tot_cost/static_cast<double>(n_costs):1.;
+    }
+    int nthreads=omp_get_max_threads();
+    cout << "rea> computing the shortest path tree by the Delta-stepping algorithm with bucket width " << delta << " using " \
+         << nthreads << " threads" << endl;
+    vector<double> cost(ktn.n_nodes,numeric_limits<double>::infinity());
+    vector<const Edge*> pred_edge(ktn.n_nodes,nullptr); // edges from predecessor nodes in the shortest path tree
+    vector<vector<int>> buckets;
+    vector<int> phase_removed(ktn.n_nodes,-1); // last bucket from which each node was removed
+    vector<vector<vector<Relax_request>>> requests(nthreads,vector<vector<Relax_request>>(nthreads));
+    vector<vector<int>> updated(nthreads); // nodes for which path costs have been relaxed by each thread
+    auto insert_node = [&](int m) {
+        size_t b=static_cast<size_t>(cost[m]/delta);
+        if (b>=buckets.size()) buckets.resize(b+1);
+        buckets[b].push_back(m);
+    };
+    /* relax the light or heavy outgoing edges of the nodes in the frontier, and insert the nodes with updated path costs into the
+       appropriate buckets */
+    auto relax_edges = [&](const vector<int> &frontier, bool light) {
+        #pragma omp parallel num_threads(nthreads)
+        {
+        int tid=omp_get_thread_num(), nteam=omp_get_num_threads();
+        for (auto &req_list: requests[tid]) req_list.clear();
+        updated[tid].clear();
+        #pragma omp for schedule(dynamic,64)
+        for (int i=0;i<static_cast<int>(frontier.size());i++) {
+            int n=frontier[i];
+            if (ktn.nodes[n].aorb==-1) continue; // a sink node cannot be a predecessor of any other node in the shortest path tree
+            const Edge *edgeptr=ktn.nodes[n].top_from;
+            while (edgeptr!=nullptr) {
+                int m=edgeptr->to_node->node_id-1;
+                if (pruned[m] || edgeptr->deadts || edgeptr->t<=0.L) { edgeptr=edgeptr->next_from; continue; }
+                double edge_cost=-static_cast<double>(log(edgeptr->t));
+                if (((edge_cost<=delta)==light) && cost[n]+edge_cost<=cost[m]) {
+                    requests[tid][m%nthreads].push_back({m,cost[n]+edge_cost,edge_cost==0.,edgeptr}); }
+                edgeptr=edgeptr->next_from;
             }
         }
+        /* each thread applies the requests for the nodes that it owns. Ties in path cost are broken by the ID of the
+           predecessor node (except for edges of zero cost, to prevent cycles), so that the shortest path tree is deterministic */
+        for (int o=tid;o<nthreads;o+=nteam) {
+            for (int t=0;t<nthreads;t++) {
+                for (const Relax_request &req: requests[t][o]) {
+                    int m=req.node;
+                    if (req.cost<cost[m]) {
+                        cost[m]=req.cost; pred_edge[m]=req.edge; updated[tid].push_back(m);
+                    } else if (req.cost==cost[m] && !req.zerocost && pred_edge[m]!=nullptr && \
+                               req.edge->from_node->node_id<pred_edge[m]->from_node->node_id) {
+                        pred_edge[m]=req.edge; }
+                }
+            }
+        }
+        }
+        for (const auto &updated_nodes: updated) {
+            for (int m: updated_nodes) insert_node(m); }
+    };
+    // main loop of the Delta-stepping algorithm
+    for (const Node *node_b: ktn.nodesB) { // paths to source nodes via virtual transitions from the super-source
+        int b=node_b->node_id-1;
+        if (pruned[b] || source_costs[b]==numeric_limits<double>::infinity()) continue;
+        cost[b]=source_costs[b]; insert_node(b);
+    }
+    double sink_cost=numeric_limits<double>::infinity(); // cost of the shortest path to the super-sink
+    size_t b_settled=numeric_limits<size_t>::max(); // last bucket for which path costs are final, if the algorithm terminates early
+    for (size_t b=0;b<buckets.size();b++) {
+        vector<int> removed; // all nodes removed from the current bucket
+        while (!buckets[b].empty()) {
+            vector<int> frontier;
+            for (int m: buckets[b]) { // remove duplicate and stale entries of the bucket
+                if (static_cast<size_t>(cost[m]/delta)!=b || phase_removed[m]==static_cast<int>(b)) continue;
+                phase_removed[m]=b; frontier.push_back(m);
+            }
+            buckets[b].clear();
+            relax_edges(frontier,true);
+            for (int m: frontier) phase_removed[m]=-1; // nodes may be reinserted into the current bucket if the path cost decreases
+            removed.insert(removed.end(),frontier.begin(),frontier.end());
+        }
+        sort(removed.begin(),removed.end()); removed.erase(unique(removed.begin(),removed.end()),removed.end());
+        relax_edges(removed,false);
+        vector<int>().swap(buckets[b]);
+        // the shortest path to the super-sink has been found, and no other paths are required
+        for (const Node *node_a: ktn.nodesA) sink_cost=min(sink_cost,cost[node_a->node_id-1]);
+        if (nabpaths==1 && static_cast<size_t>(sink_cost/delta)<=b) { b_settled=b; break; }
+    }
+    /* if the algorithm has terminated early, nodes that are not pruned and that are not in a bucket that has been processed have
+       tentative (possibly infinite) path costs, and are written with a value of -1 */
+    vector<double> path_action(cost);
+    for (int m=0;m<ktn.n_nodes;m++) {
+        if (!pruned[m] && (cost[m]==numeric_limits<double>::infinity() || static_cast<size_t>(cost[m]/delta)>b_settled)) {
+            if (b_settled!=numeric_limits<size_t>::max()) path_action[m]=-1.; }
+    }
+    Wrapper_Method::write_vec<double>(path_action,"path_action.dat",10);
+    /* trace the shortest path tree from the super-source to set the first shortest paths to all nodes */
+    vector<vector<int>> children(ktn.n_nodes);
+    for (int m=0;m<ktn.n_nodes;m++) {
+        if (pred_edge[m]!=nullptr) children[pred_edge[m]->from_node->node_id-1].push_back(m); }
+    vector<int> tree_nodes;
+    for (const Node *node_b: ktn.nodesB) { // source nodes for which the shortest path is the virtual transition from the super-source
+        int b=node_b->node_id-1;
+        if (pred_edge[b]!=nullptr || cost[b]==numeric_limits<double>::infinity()) continue;
+        shortest_paths[b].push_back({p:cost[b],t:0.,s:0.,pred_node:-1,pred_rank:0,k:0});
+        tree_nodes.push_back(b);
+    }
+    for (size_t i=0;i<tree_nodes.size();i++) {
+        int n=tree_nodes[i];
+        for (int m: children[n]) {
+            const REA_path &pred_path = shortest_paths[n][0];
+            REA_path path{p:cost[m],t:pred_path.t+static_cast<double>(ktn.nodes[n].t_esc),s:pred_path.s, \
+                          pred_node:n,pred_rank:1,k:pred_path.k+1};
+            if (!discretetime) path.s += static_cast<double>(pred_edge[m]->rev_edge->k-pred_edge[m]->k);
+            shortest_paths[m].push_back(path);
+            tree_nodes.push_back(m);
+        }
     }
 }
 
@@ -122,144 +291,136 @@ void REA::dijkstra(const Network& ktn) {
    the k-th shortest path to node v */
 void REA::next_path(const Node &vnode, int k) {
     if (debug) {
-	if (vnode==*sink_node) cout << endl;
+	if (vnode.aorb==-1) cout << endl;
 	cout << "next_path() for node: " << vnode.node_id << " path no: " << k << endl;
     }
     const Edge *edgeptr;
-    const Node *unode; int k1;
+    int u, k1;
+    int v = vnode.node_id-1;
     /* second shortest path to node v, initialise a set of candidate paths based on the first shortest path tree */
     if (k==2) {
         // loop over nodes with edges to node v
         edgeptr = vnode.top_to;
         while (edgeptr!=nullptr) {
-            unode = edgeptr->from_node;
-            // we are interested in first passage paths; the sink node cannot be a predecessor in any shortest path to any node
-            if (*unode==*sink_node) { edgeptr=edgeptr->next_to; continue; }
-            if (vnode==*source_node || !(*(shortest_paths[vnode.node_id-1][0].prev_node)==*unode)) {
+            u = edgeptr->from_node->node_id-1;
+            // we are interested in first passage paths; a sink node cannot be a predecessor in any shortest path to any node
+            if (edgeptr->from_node->aorb==-1 || pruned[u]) { edgeptr=edgeptr->next_to; continue; }
+            if (shortest_paths[v][0].pred_node!=u) {
                 /* from_node is not the predecessor of v in the shortest path tree, add the union of:
                    { 1st shortest path to node u } \cup node v    as a possible candidate for the next shortest path to node v */
-                add_candidate(&shortest_paths[unode->node_id-1][0],edgeptr);
+                add_candidate(1,edgeptr);
             }
             edgeptr=edgeptr->next_to;
         }
+        /* if the first shortest path to a source node is not the path starting at that node (i.e. the virtual transition from the
+           super-source), then this path is also a possible candidate for the next shortest path to the node */
+        if (source_costs[v]<numeric_limits<double>::infinity() && shortest_paths[v][0].pred_node>=0) {
+            candidate_paths[v].push_back({p:source_costs[v],pred_rank:0,uvedge:nullptr});
+            push_heap(candidate_paths[v].begin(),candidate_paths[v].end(),greater<REA_candidate>());
+        }
     }
-    /* second shortest path to source node must have the form of the union of:
-       { 1st shortest path to predecessor of source node } \cup source node,   all of which have already been added to the list of
-       candidate paths, so skip to selection of best candidate path */
-    if (vnode==*source_node && k==2) goto select_candidate; // skip to selection of candidate path
     /* find node u and path no. k1 that satisfy:  (k-1)-th shortest path to node v is the union of:
        { k1-th shortest path to node u } \cup node v */
-    unode = shortest_paths[vnode.node_id-1][k-2].prev_node;
-    k1 = shortest_paths[vnode.node_id-1][k-2].walker_id;
-    if (debug) cout << "node u: " << unode->node_id << " k1: " << k1 << endl;
+    u = shortest_paths[v][k-2].pred_node;
+    k1 = shortest_paths[v][k-2].pred_rank;
+    /* if the (k-1)-th shortest path to node v starts at the source node v, then there is no further path of this form, and all
+       other candidates have already been added to the list of candidate paths, so skip to selection of best candidate path */
+    if (u<0) goto select_candidate; // skip to selection of candidate path
+    if (debug) cout << "node u: " << u+1 << " k1: " << k1 << endl;
     /* if the (k1+1)-th shortest path to node u has not yet been computed (or an attempt has not yet been made, in the case of reducible Markov chains),
        then compute it with a recursive call to next_path() */
-    if (shortest_paths[unode->node_id-1][k1].prev_node==nullptr) {
-        if (!reanotirred || !nomorecands[unode->node_id-1]) next_path(*unode,k1+1);
+    edgeptr = vnode.top_to; // loop over edges to node v to find the u->v edge
+    while (edgeptr!=nullptr) {
+        if (edgeptr->from_node->node_id-1==u) break; edgeptr=edgeptr->next_to; }
+    if (edgeptr==nullptr) {
+        cout << "rea> error: there is no direct transn from node " << u+1 << " to node " << vnode.node_id << endl; exit(EXIT_FAILURE); }
+    if (static_cast<int>(shortest_paths[u].size())<=k1) {
+        if (!reanotirred || !nomorecands[u]) next_path(*edgeptr->from_node,k1+1);
     }
     /* at this point, the (k1+1)-th shortest path to node u should now have been determined if the Markov chain is irreducible */
-    if (shortest_paths[unode->node_id-1][k1].prev_node==nullptr) {
-	if (debug) cout << "(k1+1)-th shortest path to node u DOES NOT EXIST    k1: " << k1 << "    node u: " << unode->node_id << endl;
+    if (static_cast<int>(shortest_paths[u].size())<=k1) {
+	if (debug) cout << "(k1+1)-th shortest path to node u DOES NOT EXIST    k1: " << k1 << "    node u: " << u+1 << endl;
         if (!reanotirred) {
-	    cout << "rea> error: failed to determine the " << k1+1 << "-th shortest path to node " << unode->node_id << endl; exit(EXIT_FAILURE);
+	    cout << "rea> error: failed to determine the " << k1+1 << "-th shortest path to node " << u+1 << endl; exit(EXIT_FAILURE);
 	} else {
             goto select_candidate; // no new found path to add to the list of candidates, so skip to selection of candidate path
 	}
     }
-    if (debug) cout << "(k1+1)-th shortest path to node u EXISTS    k1: " << k1 << "    node u: " << unode->node_id << endl;
-    /* loop over edges from node u to find the u->v edge */
-    edgeptr = unode->top_from;
-    while (edgeptr!=nullptr) {
-        if (*(edgeptr->to_node)==vnode) break; edgeptr=edgeptr->next_from; }
-    if (edgeptr==nullptr) {
-        cout << "rea> error: there is no direct transn from node " << unode->node_id << " to node " << vnode.node_id << endl; exit(EXIT_FAILURE); }
+    if (debug) cout << "(k1+1)-th shortest path to node u EXISTS    k1: " << k1 << "    node u: " << u+1 << endl;
     /* add the union of:
        { (k1+1)-th shortest path to node u } \cup node v    as a possible candidate for the next shortest path to node v */
-    add_candidate(&shortest_paths[unode->node_id-1][k1],edgeptr);
-    // program skips directly to here after initialising list of candidate paths when vnode is the source node and k==2
+    add_candidate(k1+1,edgeptr);
+    // program skips directly to here if the (k-1)-th shortest path to vnode starts at vnode
     select_candidate: select_candidate(vnode,k); // find the candidate for the next (i.e. k-th) shortest path to node v with the lowest cost
 }
 
-/* add the union of: { k-th shortest path to node u } \cup node v,   where u/v are the to/from nodes associated with uvedge, respectively,
-   and the corresponding path to node u is pointed to by cand_path,   as a possible candidate for the next shortest path to node v  */
-void REA::add_candidate(const Walker *cand_path, const Edge *uvedge) {
+/* add the union of: { k-th shortest path to node u } \cup node v,   where u/v are the from/to nodes associated with uvedge, respectively,
+   as a possible candidate for the next shortest path to node v  */
+void REA::add_candidate(int k, const Edge *uvedge) {
     if (debug) {
-        cout << "add_candidate() to node: " << uvedge->to_node->node_id << "    path no. " << cand_path->path_no \
-             << "    from node: " << uvedge->from_node->node_id << "    weight of parent path: " << cand_path->p << endl;
+        cout << "add_candidate() to node: " << uvedge->to_node->node_id << "    path no. " << k \
+             << "    from node: " << uvedge->from_node->node_id << "    weight of parent path: " \
+             << shortest_paths[uvedge->from_node->node_id-1][k-1].p << endl;
     }
     int v = uvedge->to_node->node_id;
-    bool foundempty=false; // boolean value to indicate if an available space in the candidate_paths array has been found
-    for (int i=0;i<uvedge->to_node->udeg;i++) {
-        if (candidate_paths[v-1][i].first==nullptr) {
-            candidate_paths[v-1][i].first=cand_path;
-            candidate_paths[v-1][i].second=uvedge;
-            foundempty=true;
-            break;
-        }
-    }
-    if (!foundempty) { cout << "rea> error: number of candidate paths exceeds max. possible number" << endl; exit(EXIT_FAILURE); }
+    // there is at most one candidate path for each edge to node v (and one starting at node v, if it is a source node)
+    if (static_cast<int>(candidate_paths[v-1].size())>=uvedge->to_node->udeg+(uvedge->to_node->aorb==1)) {
+        cout << "rea> error: number of candidate paths exceeds max. possible number" << endl; exit(EXIT_FAILURE); }
+    double cost = shortest_paths[uvedge->from_node->node_id-1][k-1].p - static_cast<double>(log(uvedge->t));
+    candidate_paths[v-1].push_back({p:cost,pred_rank:k,uvedge:uvedge});
+    push_heap(candidate_paths[v-1].begin(),candidate_paths[v-1].end(),greater<REA_candidate>());
 }
 
-/* select the best candidate (i.e. that with lowest cost) and assign as the k-th shortest path to node v, and remove the chosen
-   candidate path from the list */
+/* select the best candidate (i.e. that with lowest cost), which is at the top of the heap of candidates for node v, and assign as
+   the k-th shortest path to node v, and remove the chosen candidate path from the heap */
 void REA::select_candidate(const Node &vnode, int k) {
     if (debug) cout << "in select_candidate for node: " << vnode.node_id << " path no.: " << k << endl;
     int v = vnode.node_id;
-    int m=-1; long double mincost=numeric_limits<long double>::infinity();
-    for (int i=0;i<vnode.udeg;i++) { // loop over candidate paths
-        if (candidate_paths[v-1][i].first==nullptr) continue; // empty space in list of candidate paths
-        if (debug) {
-            cout << "  idx: " << i << endl; cout << "    path no. : " << candidate_paths[v-1][i].first->path_no \
-                 << "    to node u: " << candidate_paths[v-1][i].first->curr_node->node_id << endl;
-            cout << "    cost of  { path to u } cup v: " << candidate_paths[v-1][i].first->p - log(candidate_paths[v-1][i].second->t) << endl;
-        }
-        if (candidate_paths[v-1][i].first->p - log(candidate_paths[v-1][i].second->t) < mincost) {
-            m=i; // m represents the index of the best candidate path in the list of all candidate paths for node v
-            mincost = candidate_paths[v-1][i].first->p - log(candidate_paths[v-1][i].second->t);
-        }
-    }
-    if (m<0 && reanotirred) { // candidate path cannot be found for this node, but for reducible Markov chain this is allowed
+    if (candidate_paths[v-1].empty() && reanotirred) { // candidate path cannot be found for this node, but for reducible Markov chain this is allowed
 	if (debug) cout << "no available candidate for " << k << "-th shortest path to node " << vnode.node_id << endl;
 	nomorecands[vnode.node_id-1]=true;
         return;
-    } else if (m<0) {
+    } else if (candidate_paths[v-1].empty()) {
 	cout << "rea> error: no candidates for next shortest path to node " << vnode.node_id << endl; exit(EXIT_FAILURE);
     }
-    if (debug) cout << "  selected candidate idx m: " << m << "    mincost: " << mincost << endl;
-    // assign the properties of the best candidate path to the k-th shortest path to node v
-    shortest_paths[v-1][k-1].p = candidate_paths[v-1][m].first->p - log(candidate_paths[v-1][m].second->t);
-    shortest_paths[v-1][k-1].k = candidate_paths[v-1][m].first->k + 1;
-    shortest_paths[v-1][k-1].t = candidate_paths[v-1][m].first->t + candidate_paths[v-1][m].second->from_node->t_esc;
-    if (!discretetime) {
-        shortest_paths[v-1][k-1].s = candidate_paths[v-1][m].first->s + \
-                (candidate_paths[v-1][m].second->rev_edge->k - candidate_paths[v-1][m].second->k);
+    pop_heap(candidate_paths[v-1].begin(),candidate_paths[v-1].end(),greater<REA_candidate>());
+    REA_candidate cand = candidate_paths[v-1].back();
+    candidate_paths[v-1].pop_back();
+    if (debug) cout << "  selected candidate from node: " << ((cand.uvedge==nullptr)?0:cand.uvedge->from_node->node_id) \
+                    << "    path no. : " << cand.pred_rank << "    mincost: " << cand.p << endl;
+    if (cand.uvedge==nullptr) { // the candidate path starts at the source node v
+        shortest_paths[v-1].push_back({p:cand.p,t:0.,s:0.,pred_node:-1,pred_rank:0,k:0});
+        return;
     }
-    shortest_paths[v-1][k-1].prev_node = candidate_paths[v-1][m].second->from_node;
-    shortest_paths[v-1][k-1].walker_id = candidate_paths[v-1][m].first->path_no;
-    // delete the selected candidate path from the list
-    candidate_paths[v-1][m].first=nullptr; candidate_paths[v-1][m].second=nullptr;
+    // assign the properties of the best candidate path to the k-th shortest path to node v
+    int u = cand.uvedge->from_node->node_id-1;
+    const REA_path &upath = shortest_paths[u][cand.pred_rank-1];
+    REA_path path{p:cand.p,t:upath.t+static_cast<double>(cand.uvedge->from_node->t_esc),s:upath.s,pred_node:u, \
+                  pred_rank:cand.pred_rank,k:upath.k+1};
+    if (!discretetime) path.s += static_cast<double>(cand.uvedge->rev_edge->k-cand.uvedge->k);
+    shortest_paths[v-1].push_back(path);
 }
 
-/* print the k shortest paths to the sink node from the source node by tracing the elements in the array of the k shortest paths
+/* print the k shortest paths to the super-sink from the super-source by tracing the elements in the array of the k shortest paths
    to all nodes (note that the paths are therefore printed backwards) */
-void REA::print_shortest_paths(int nspaths) {
-    if (debug) cout << "printing " << nspaths << " shortest paths" << endl;
-    const Walker *walker;
-    for (int k=1;k<nspaths+1;k++) {
+void REA::print_shortest_paths(const Network &ktn, const vector<pair<int,int>> &sink_paths) {
+    if (debug) cout << "printing " << sink_paths.size() << " shortest paths" << endl;
+    for (int k=1;k<static_cast<int>(sink_paths.size())+1;k++) {
         ofstream spath_f;
         string spath_fname="shortest_path."+to_string(k)+".dat";
         spath_f.open(spath_fname,ios_base::trunc);
         spath_f.setf(ios::right,ios::adjustfield); spath_f.setf(ios::scientific,ios::floatfield);
         spath_f.precision(10);
-        // start from k-th shortest path to sink node and loop to trace back through the k shortest paths array
-        walker = &shortest_paths[sink_node->node_id-1][k-1];
+        // start from k-th shortest path to super-sink and loop to trace back through the k shortest paths array
+        int n=sink_paths[k-1].first, kn=sink_paths[k-1].second;
         while (true) {
             // print path information
-            spath_f << setw(7) << walker->curr_node->node_id << setw(7) << walker->curr_node->comm_id;
-            spath_f << setw(25) << walker->t << setw(30) << walker->k << setw(25) << walker->p << setw(25) << walker->s << endl;
-            if (walker->prev_node==nullptr) break;
+            const REA_path &path = shortest_paths[n][kn-1];
+            spath_f << setw(7) << ktn.nodes[n].node_id << setw(7) << ktn.nodes[n].comm_id;
+            spath_f << setw(25) << path.t << setw(30) << path.k << setw(25) << path.p << setw(25) << path.s << endl;
+            if (path.pred_node<0) break;
             // find parent path of current path in k shortest paths array
-            walker = &shortest_paths[walker->prev_node->node_id-1][walker->walker_id-1];
+            n=path.pred_node; kn=path.pred_rank;
         }
     }
 }
@@ -24,6 +24,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <cmath>
 #include <string>
+#include <queue>
+#include <algorithm>
+#include <cstdio>
+#include <functional>
 
 using namespace std;
 
@@ -78,6 +82,7 @@ void KPS::calc_committor(const Network& ktn) {
     Wrapper_Method::write_vec<long double>(q_ab_vals,"committor_AB.dat");
     Wrapper_Method::write_vec<long double>(q_ba_vals,"committor_BA.dat");
     cout << "kps> finished writing committor probabilities to files" << endl;
+    if (sr_args.tpt) calc_tpt(ktn,q_ab_vals,q_ba_vals);
 }
 
 /* calculate the committor probability for an initial node at the boundary of the initial state, which is /= 0 */
@@ -93,6 +98,113 @@ long double KPS::committor_boundary_node(const Network& ktn, int node_id, const
     return q_val;
 }
 
+/* compute the quantities of transition path theory (TPT) for the A<-B transition from the committor probabilities. The reactive
+   flux along the i->j edge is f_ij = pi_i q^-_i K_ij q^+_j, where q^+ is the A<-B committor, q^- is the backward committor
+   (i.e. the probability that a trajectory at node i last visited B rather than A), and K_ij = T_ij/tau_i is the transition rate
+   (for a DTMC, K_ij is the transition probability per unit time). The backward committor is equal to the B<-A committor if the
+   Markov chain satisfies detailed balance, and is otherwise computed by graph transformation of the time-reversed Markov chain.
+   The total reactive flux F is the flux out of B, and the A<-B rate constant is F/sum_i pi_i q^-_i.
+   The reactive fluxes and net reactive fluxes for edges with positive net reactive flux are written to "tpt_flux.dat", and the
+   backward committor probabilities, normalised probability distribution of reactive trajectories pi_i q^-_i q^+_i / Z_AB, and
+   expected numbers of escapes from nodes per reactive trajectory, are written to "tpt_nodes.dat" */
+void KPS::calc_tpt(const Network &ktn, const vector<long double> &q_ab_vals, const vector<long double> &q_ba_vals) {
+
+    cout << "kps> calculating reactive fluxes of transition path theory from the committor probabilities" << endl;
+    int n_edges=ktn.edges.size();
+    bool revers=true; // Markov chain satisfies detailed balance (Y/N)
+    #pragma omp parallel for reduction(&&:revers)
+    for (int i=0;i<n_edges;i+=2) {
+        const Edge &edge=ktn.edges[i];
+        if (edge.deadts) continue;
+        long double j_ij=exp(edge.from_node->pi)*edge.t/edge.from_node->t_esc;
+        long double j_ji=exp(edge.to_node->pi)*edge.rev_edge->t/edge.to_node->t_esc;
+        revers = revers && (abs(j_ij-j_ji)<=1.E-08*max(j_ij,j_ji));
+    }
+    vector<long double> q_plus(ktn.n_nodes), q_minus(ktn.n_nodes);
+    if (!revers) {
+        cout << "kps> Markov chain does not satisfy detailed balance, computing backward committor probabilities" << endl;
+        q_minus=KPS::calc_backward_committor(ktn); }
+    for (const Node &node: ktn.nodes) {
+        int i=node.node_pos;
+        if (node.aorb==-1) { q_plus[i]=1.L; q_minus[i]=0.L;
+        } else if (node.aorb==1) { q_plus[i]=0.L; q_minus[i]=1.L;
+        } else { q_plus[i]=q_ab_vals[i]; if (revers) q_minus[i]=q_ba_vals[i]; }
+    }
+    vector<long double> flux(n_edges,0.L); // reactive fluxes along edges
+    long double flux_ab=0.L; // total reactive flux
+    #pragma omp parallel for reduction(+:flux_ab)
+    for (int i=0;i<n_edges;i++) {
+        const Edge &edge=ktn.edges[i];
+        if (edge.deadts) continue;
+        int u=edge.from_node->node_pos, v=edge.to_node->node_pos;
+        if (q_minus[u]==0.L || q_plus[v]==0.L) continue;
+        flux[i]=exp(edge.from_node->pi)*q_minus[u]*(edge.t/edge.from_node->t_esc)*q_plus[v];
+        if (edge.from_node->aorb==1 && edge.to_node->aorb!=1) flux_ab+=flux[i];
+    }
+    vector<long double> react_probs(ktn.n_nodes), escapes(ktn.n_nodes,0.L);
+    long double z_ab=0.L; // normalisation factor for probability distribution of reactive trajectories
+    long double pi_minus=0.L; // total probability of nodes last visiting B
+    #pragma omp parallel for reduction(+:z_ab,pi_minus)
+    for (int i=0;i<ktn.n_nodes;i++) {
+        const Node &node=ktn.nodes[i];
+        react_probs[i]=exp(node.pi)*q_minus[i]*q_plus[i];
+        z_ab+=react_probs[i]; pi_minus+=exp(node.pi)*q_minus[i];
+        if (node.aorb==-1) continue; // reactive trajectories terminate upon hitting A
+        const Edge *edgeptr = node.top_from;
+        while (edgeptr!=nullptr) {
+            escapes[i]+=flux[edgeptr->edge_id]; edgeptr=edgeptr->next_from; }
+    }
+    ofstream flux_f; flux_f.open("tpt_flux.dat");
+    flux_f.setf(ios::right,ios::adjustfield); flux_f.setf(ios::scientific,ios::floatfield); flux_f.precision(10);
+    for (int i=0;i<n_edges;i++) {
+        const Edge &edge=ktn.edges[i];
+        long double net_flux=flux[i]-flux[edge.rev_edge->edge_id];
+        if (edge.deadts || net_flux<=0.L) continue;
+        flux_f << setw(5) << edge.from_node->node_id << setw(5) << edge.to_node->node_id << setw(18) << flux[i] \
+               << setw(18) << net_flux << "\n";
+    }
+    flux_f.close();
+    ofstream nodes_f; nodes_f.open("tpt_nodes.dat");
+    nodes_f.setf(ios::right,ios::adjustfield); nodes_f.setf(ios::scientific,ios::floatfield); nodes_f.precision(10);
+    for (const Node &node: ktn.nodes) {
+        int i=node.node_pos;
+        nodes_f << setw(5) << node.node_id << setw(18) << q_minus[i] << setw(18) << ((z_ab>0.L)?react_probs[i]/z_ab:0.L) \
+                << setw(18) << ((flux_ab>0.L)?escapes[i]/flux_ab:0.L) << "\n";
+    }
+    nodes_f.close();
+    cout << "kps> the total A<-B reactive flux is:" << string(7,' ') << setw(18) << scientific << setprecision(10) << flux_ab << endl;
+    cout << "kps> the A<-B rate constant (TPT) is:" << string(7,' ') << setw(18) << flux_ab/pi_minus << endl;
+    cout << "kps> finished writing reactive fluxes to files" << endl;
+}
+
+/* compute the backward committor probabilities q^-_i (the probability that a trajectory at node i last visited B rather than A)
+   for a Markov chain that does not satisfy detailed balance, which are the B<-A committor probabilities for the time-reversed
+   Markov chain. The nodes not in A or B are eliminated by graph transformation of the sparse time-reversed network, and the
+   backward committor probabilities are obtained by back-substitution (with the boundary conditions q^-=0 in A and q^-=1 in B) */
+vector<long double> KPS::calc_backward_committor(const Network &ktn) {
+    GT_sparse gt = KPS::get_gt_sparse(ktn,false,true);
+    vector<GT_factor> factors;
+    priority_queue<pair<int,int>,vector<pair<int,int>>,greater<pair<int,int>>> gt_pq;
+    for (const Node &node: ktn.nodes) {
+        if (node.aorb==0) gt_pq.push(make_pair(gt.rows[node.node_pos].size(),node.node_pos)); }
+    while (!gt_pq.empty()) {
+        pair<int,int> elem=gt_pq.top(); gt_pq.pop();
+        if (gt.eliminated[elem.second]) continue;
+        if (elem.first!=static_cast<int>(gt.rows[elem.second].size())) { // degree has changed since the node was queued
+            gt_pq.push(make_pair(gt.rows[elem.second].size(),elem.second)); continue; }
+        KPS::gt_sparse_iteration(gt,elem.second,factors);
+    }
+    vector<long double> q_minus(ktn.n_nodes,0.L);
+    for (const Node *nodeptr: ktn.nodesB) q_minus[nodeptr->node_pos]=1.L;
+    for (vector<GT_factor>::reverse_iterator it_fac=factors.rbegin();it_fac!=factors.rend();++it_fac) {
+        if (it_fac->factor==0.L) continue; // node is not visited at equilibrium
+        long double val=0.L;
+        for (const auto &elem: it_fac->row) val+=elem.second*q_minus[elem.first];
+        q_minus[it_fac->node]=val/it_fac->factor;
+    }
+    return q_minus;
+}
+
 /* compute and write absorption probabilities. NB At this point, pi values of the ktn_kps object should, for
    initial nodes, have been overwritten to the initial probability distribution values */
 void KPS::calc_absprobs() {
@@ -119,15 +231,544 @@ void KPS::calc_absprobs() {
     cout << "kps> finished writing absorption probabilities to files" << endl;
 }
 
-/* write the elements of the fundamental matrix for an absorbing (i.e. reducible) Markov chain */
+/* compute the MFPTs for all pairs of nodes of an irreducible Markov chain, and hence the fundamental matrix and the Kemeny constant */
+void KPS::calc_fundamentalirred(const Network &ktn) {
+    cout << "kps> calculating MFPTs for all pairs of nodes and the fundamental matrix by blocked graph transformation" << endl;
+    calc_allpairs(ktn,true);
+    cout << "kps> finished writing all-pairs MFPTs and elements of the fundamental matrix to files" << endl;
+}
+
+/* compute the elements of the fundamental matrix for an absorbing (i.e. reducible) Markov chain, and hence the expected numbers
+   of node visits along first passage paths given the initial probability distribution */
 void KPS::calc_fundamentalred(const Network &ktn) {
-    cout << "kps> calculating expected numbers of node visits from the graph transformation" << endl;
-    write_renormalised_probs("transient_visits.dat"); // compute expected number of visits of node j given that trajectories are initialised at node i
-    if (sr_args.gth) return; // the stationary distribution is not known at this point
-    // ...
+    cout << "kps> calculating expected numbers of node visits by blocked graph transformation" << endl;
+    calc_allpairs(ktn,false);
     cout << "kps> finished writing expected numbers of node visits to files" << endl;
 }
 
+/* Blocked graph transformation to compute a dense matrix of dynamical quantities for all pairs of nodes. If irred, the elements
+   are the MFPTs m_ij for transitions i->j between all pairs of nodes in an irreducible Markov chain, else the elements are the
+   expected numbers of visits n_ij to transient node j along first passage paths initialised from transient node i.
+   Each column of the matrix (i.e. for a fixed target node j) requires elimination of all nodes except j. The nonabsorbing nodes
+   are partitioned into blocks of target nodes, and for each block, all nodes outside of the block are eliminated only once (with
+   sparse GT, storing the factors). Then, for each target node of the block, the remaining nodes of the (small, dense) reduced
+   block are eliminated, and the column is obtained by back-substitution. Blocks are distributed dynamically among threads.
+   If sr_args.fundstream, the elements are written to file as each column is completed and the dense matrix is never stored */
+void KPS::calc_allpairs(const Network &ktn, bool irred) {
+
+    int n=ktn.n_nodes, bsz=sr_args.fundblocksz;
+    GT_sparse gt_base = KPS::get_gt_sparse(ktn,irred);
+    /* order nonabsorbing nodes by breadth-first search, so that the nodes of each block of targets are local in the network */
+    vector<int> bfs_order; bfs_order.reserve(n);
+    vector<bool> queued(n,false);
+    for (int i=0;i<n;i++) {
+        if (queued[i] || (!irred && ktn.nodes[i].aorb==-1)) continue;
+        queue<int> nbr_queue; nbr_queue.push(i); queued[i]=true;
+        while (!nbr_queue.empty()) {
+            int j=nbr_queue.front(); nbr_queue.pop();
+            bfs_order.push_back(j);
+            for (const auto &elem: gt_base.rows[j]) {
+                if (!queued[elem.first]) { queued[elem.first]=true; nbr_queue.push(elem.first); } }
+        }
+    }
+    int n_trans=bfs_order.size(), nblocks=(n_trans+bsz-1)/bsz;
+    cout << "kps> no. of target nodes: " << n_trans << "   no. of blocks: " << nblocks << "   max. block size: " << bsz << endl;
+    /* stationary probabilities (for the fundamental matrix) or initial probabilities (for the node visits) */
+    vector<long double> probs;
+    if (irred) {
+        probs.resize(n);
+        for (int i=0;i<n;i++) probs[i]=exp(ktn.nodes[i].pi);
+    } else {
+        probs=KPS::get_init_probs(ktn);
+    }
+    vector<long double> allpairs_mtx; // dense matrix (not used if elements are streamed to files)
+    vector<long double> colvals(n,0.L); // sum_k pi_k m_kj (for MFPTs) or expected no. of visits given initial distribn (for node visits)
+    if (!sr_args.fundstream) allpairs_mtx.resize(static_cast<size_t>(n)*static_cast<size_t>(n),0.L);
+    ofstream mtx_f, fund_f;
+    if (sr_args.fundstream) {
+        mtx_f.open(irred?"mfpt_allpairs.dat":"transient_visits.dat");
+        mtx_f.setf(ios::right,ios::adjustfield); mtx_f.setf(ios::scientific,ios::floatfield); mtx_f.precision(10);
+        if (irred) {
+            fund_f.open("fundamental.dat");
+            fund_f.setf(ios::right,ios::adjustfield); fund_f.setf(ios::scientific,ios::floatfield); fund_f.precision(10); }
+    }
+    long double kemeny=0.L; // Kemeny constant (trace of the fundamental matrix)
+    #pragma omp parallel for schedule(dynamic) reduction(+:kemeny)
+    for (int b=0;b<nblocks;b++) {
+        vector<int> bnodes(bfs_order.begin()+b*bsz,bfs_order.begin()+min((b+1)*bsz,n_trans));
+        int nb=bnodes.size();
+        vector<int> loc(n,-1); // local indices of nodes in the block
+        for (int u=0;u<nb;u++) loc[bnodes[u]]=u;
+        /* sparse GT to eliminate all nonabsorbing nodes outside of the block, in order of (dynamically updated) minimum degree */
+        GT_sparse gt_blk = gt_base;
+        vector<GT_factor> factors; factors.reserve(n_trans-nb);
+        priority_queue<pair<int,int>,vector<pair<int,int>>,greater<pair<int,int>>> gt_pq;
+        for (int i: bfs_order) { if (loc[i]<0) gt_pq.push(make_pair(gt_blk.rows[i].size(),i)); }
+        while (!gt_pq.empty()) {
+            pair<int,int> elem=gt_pq.top(); gt_pq.pop();
+            if (gt_blk.eliminated[elem.second]) continue;
+            if (elem.first!=static_cast<int>(gt_blk.rows[elem.second].size())) { // degree has changed since the node was queued
+                gt_pq.push(make_pair(gt_blk.rows[elem.second].size(),elem.second)); continue; }
+            KPS::gt_sparse_iteration(gt_blk,elem.second,factors);
+        }
+        /* dense representation of the reduced block */
+        vector<long double> tmtx_blk(nb*nb,0.L), tau_blk(nb), pabs_blk(nb);
+        for (int u=0;u<nb;u++) {
+            tau_blk[u]=gt_blk.tau[bnodes[u]]; pabs_blk[u]=gt_blk.pabs[bnodes[u]];
+            for (const auto &elem: gt_blk.rows[bnodes[u]]) tmtx_blk[(u*nb)+loc[elem.first]]=elem.second;
+        }
+        vector<long double> col(n,0.L); // column of the matrix for the current target node
+        for (int jj=0;jj<nb;jj++) {
+            int j=bnodes[jj];
+            vector<long double> w(tmtx_blk), tw(tau_blk), aw(pabs_blk), dw(nb);
+            /* eliminate all nodes of the block except the target node, in order of local indices. When the x-th node is
+               eliminated, the noneliminated nodes are those with local index greater than x, and the target node */
+            vector<vector<int>> nonelim(nb);
+            for (int x=0;x<nb;x++) {
+                if (x==jj) continue;
+                for (int z=x+1;z<nb;z++) nonelim[x].push_back(z);
+                if (jj<x) nonelim[x].push_back(jj);
+                dw[x]=aw[x];
+                for (int z: nonelim[x]) dw[x]+=w[(x*nb)+z];
+                for (int y: nonelim[x]) {
+                    long double f=w[(y*nb)+x]/dw[x];
+                    if (f==0.L) continue;
+                    tw[y]+=f*tw[x]; aw[y]+=f*aw[x];
+                    for (int z: nonelim[x]) { if (z!=y) w[(y*nb)+z]+=f*w[(x*nb)+z]; }
+                }
+            }
+            // back-substitution for nodes of the block
+            col[j]=irred?0.L:1.L; // MFPT to target node, or probability of hitting target node, is trivial for the target node itself
+            for (int x=nb-1;x>=0;x--) {
+                if (x==jj) continue;
+                long double val=irred?tw[x]:0.L;
+                for (int z: nonelim[x]) val+=w[(x*nb)+z]*col[bnodes[z]];
+                col[bnodes[x]]=val/dw[x];
+            }
+            // back-substitution for nodes outside of the block, in reverse order of elimination
+            for (vector<GT_factor>::reverse_iterator it_fac=factors.rbegin();it_fac!=factors.rend();++it_fac) {
+                long double val=irred?it_fac->tau:0.L;
+                for (const auto &elem: it_fac->row) val+=elem.second*col[elem.first];
+                col[it_fac->node]=val/it_fac->factor;
+            }
+            /* the hitting probabilities for the target node are normalised by the escape probability from the target node to
+               the absorbing set (without return) to give the expected numbers of visits */
+            if (!irred) { for (int i: bfs_order) col[i]*=1.L/aw[jj]; }
+            long double colval=0.L;
+            for (int i: bfs_order) colval+=probs[i]*col[i];
+            colvals[j]=colval;
+            if (irred) kemeny+=probs[j]*colval; // diagonal element of the fundamental matrix
+            if (!sr_args.fundstream) {
+                for (int i: bfs_order) allpairs_mtx[(static_cast<size_t>(i)*n)+j]=col[i];
+            } else {
+                #pragma omp critical(write_allpairs)
+                {
+                for (int i: bfs_order) {
+                    mtx_f << setw(5) << i+1 << setw(5) << j+1 << setw(18) << col[i] << "\n";
+                    if (irred) fund_f << setw(5) << i+1 << setw(5) << j+1 << setw(18) << probs[j]*(colval-col[i]) << "\n";
+                }
+                }
+            }
+        }
+    }
+    if (!sr_args.fundstream) { // write the dense matrices in row-major order
+        mtx_f.open(irred?"mfpt_allpairs.dat":"transient_visits.dat");
+        mtx_f.setf(ios::right,ios::adjustfield); mtx_f.setf(ios::scientific,ios::floatfield); mtx_f.precision(10);
+        if (irred) {
+            fund_f.open("fundamental.dat");
+            fund_f.setf(ios::right,ios::adjustfield); fund_f.setf(ios::scientific,ios::floatfield); fund_f.precision(10); }
+        vector<int> trans_nodes(bfs_order); sort(trans_nodes.begin(),trans_nodes.end());
+        for (int i: trans_nodes) {
+            for (int j: trans_nodes) {
+                long double val=allpairs_mtx[(static_cast<size_t>(i)*n)+j];
+                mtx_f << setw(5) << i+1 << setw(5) << j+1 << setw(18) << val << "\n";
+                if (irred) fund_f << setw(5) << i+1 << setw(5) << j+1 << setw(18) << probs[j]*(colvals[j]-val) << "\n";
+            }
+        }
+    }
+    mtx_f.close(); if (irred) fund_f.close();
+    if (irred) {
+        cout << "kps> the Kemeny constant is:" << string(5,' ') << setw(18) << scientific << setprecision(10) << kemeny << endl;
+    } else {
+        ofstream visits_f; visits_f.open("node_visits.dat");
+        visits_f.setf(ios::right,ios::adjustfield); visits_f.setf(ios::scientific,ios::floatfield); visits_f.precision(10);
+        for (int j=0;j<n;j++) {
+            if (ktn.nodes[j].aorb==-1) continue;
+            visits_f << setw(5) << j+1 << setw(18) << colvals[j] << endl;
+        }
+    }
+}
+
+/* construct the sparse representation of the Markov chain used in the blocked graph transformation. If irred, there are no
+   absorbing nodes, else transitions to the absorbing set A are subsumed into the renormalised absorption probabilities.
+   If reversed, the transition probabilities are those of the time-reversed Markov chain, T~_ij = pi_j T_ji tau_i / (pi_i tau_j) */
+GT_sparse KPS::get_gt_sparse(const Network &ktn, bool irred, bool reversed) {
+    GT_sparse gt;
+    gt.rows.resize(ktn.n_nodes); gt.tau.resize(ktn.n_nodes); gt.pabs.resize(ktn.n_nodes,0.L);
+    gt.eliminated.resize(ktn.n_nodes,false);
+    for (const Node &node: ktn.nodes) {
+        gt.tau[node.node_pos]=node.t_esc;
+        if (!irred && node.aorb==-1) { gt.eliminated[node.node_pos]=true; continue; } // absorbing nodes are never eliminated
+        const Edge *edgeptr = node.top_from;
+        while (edgeptr!=nullptr) {
+            if (!edgeptr->deadts) {
+                long double t=edgeptr->t;
+                if (reversed) {
+                    t=(node.pi==-numeric_limits<long double>::infinity())?0.L:exp(edgeptr->to_node->pi-node.pi)* \
+                      edgeptr->rev_edge->t*node.t_esc/edgeptr->to_node->t_esc; }
+                if (!irred && edgeptr->to_node->aorb==-1) { gt.pabs[node.node_pos]+=t;
+                } else { gt.rows[node.node_pos][edgeptr->to_node->node_pos]+=t; }
+            }
+            edgeptr=edgeptr->next_from;
+        }
+    }
+    return gt;
+}
+
+/* a single iteration of graph transformation on the sparse representation of the Markov chain, to eliminate the node with
+   position x. The factors required to undo the elimination are appended to the factors vector. The sparsity pattern is
+   symmetric (edges are bidirectional), so the nodes with edges to the eliminated node are given by its outgoing edges.
+   If storecol, the factors T_{yx}/(1-T_{xx}) are also stored, so that the elimination can be repeated for an additional
+   right-hand side vector (in place of the mean waiting times). Returns the change in the number of stored elements */
+long long int KPS::gt_sparse_iteration(GT_sparse &gt, int x, vector<GT_factor> &factors, bool storecol) {
+    GT_factor fac{x,gt.tau[x],gt.pabs[x],gt.pabs[x],vector<pair<int,long double>>(gt.rows[x].begin(),gt.rows[x].end())};
+    for (const auto &elem: fac.row) fac.factor+=elem.second; // (1-T_{xx}) computed as in GTH algorithm
+    long long int nnz=0; // change in the number of stored elements
+    for (const auto &elem_y: fac.row) {
+        if (gt.eliminated[elem_y.first]) continue; // pruned node, which is never eliminated and is not updated
+        unordered_map<int,long double> &row_y = gt.rows[elem_y.first];
+        long long int nnz_y = row_y.size();
+        unordered_map<int,long double>::iterator it_y = row_y.find(x);
+        long double t_yx=0.L;
+        if (it_y!=row_y.end()) { t_yx=it_y->second; row_y.erase(it_y); }
+        long double f=t_yx/fac.factor;
+        if (storecol && f>0.L) fac.col.push_back(make_pair(elem_y.first,f));
+        gt.tau[elem_y.first]+=f*fac.tau; gt.pabs[elem_y.first]+=f*fac.pabs;
+        for (const auto &elem_z: fac.row) { // update (or add) edges between pairs of neighbouring nodes
+            if (elem_z.first!=elem_y.first) row_y[elem_z.first]+=f*elem_z.second; }
+        nnz+=static_cast<long long int>(row_y.size())-nnz_y;
+    }
+    nnz-=gt.rows[x].size();
+    gt.rows[x].clear(); gt.eliminated[x]=true;
+    factors.push_back(move(fac));
+    return nnz;
+}
+
+/* Out-of-core graph transformation to compute the committor probabilities and/or the MFPTs to the absorbing set A, for networks
+   where the fill-in exceeds the available memory. Nodes are eliminated from a sparse representation of the network (the active
+   network) in order of (dynamically updated) minimum degree. The factors of eliminated nodes, which are required for the
+   back-substitution phase, are buffered in memory and are flushed to a scratch file whenever the estimated memory of the active
+   network plus the buffer exceeds sr_args.memlimit. The factors are then read back in chunks, in reverse order of elimination,
+   for the back-substitution. Committor probabilities require that the nodes of the set B are eliminated last.
+   If sr_args.fptmoments, the second and third moments of the first passage time distribution are also computed, by repeating
+   the forward and backward substitution steps with the right-hand side vectors given by the lower moments. This procedure is
+   also used (with no limit on memory) for the in-core computation of the higher moments */
+void KPS::calc_outofcore(const Network &ktn) {
+
+    if (sr_args.memlimit>0.) {
+        cout << "kps> out-of-core graph transformation with max. memory for the active network of " << sr_args.memlimit << " MB" << endl;
+    } else {
+        cout << "kps> graph transformation of sparse network with factors stored in memory" << endl; }
+    const double memlimit_bytes=(sr_args.memlimit>0.)?sr_args.memlimit*1024.*1024.:numeric_limits<double>::infinity();
+    const double elem_bytes=sizeof(pair<int,long double>)+(2*sizeof(void*)); // estimated memory per element of the active network
+    const double node_bytes=sizeof(unordered_map<int,long double>)+(2*sizeof(long double)); // memory per node of the active network
+    string scratch_fname=(sr_args.scratchfile!=nullptr)?string(sr_args.scratchfile):"gt_factors.scratch";
+    GT_sparse gt = KPS::get_gt_sparse(ktn,false);
+    /* nodes from which A cannot be reached are pruned, and are never eliminated. These nodes act as a boundary of the
+       noneliminated nodes with infinite MFPT and with zero A<-B committor probabilities. Nodes that cannot be reached from B
+       are not pruned, since the MFPTs and committor probabilities are written for all nodes, but they are transformed only
+       within their own independent components */
+    vector<bool> toA = ktn.get_reachable(ktn.nodesA,false);
+    vector<bool> toB = ktn.get_reachable(ktn.nodesB,false);
+    /* a pruned node from which B can be reached has a B<-A committor probability of unity only if the trajectory cannot instead be
+       trapped in a closed class of nodes that does not contain B, i.e. only if a node from which B cannot be reached is not itself
+       reachable from the pruned node without passing through B. Otherwise the committor probability is not determined by the
+       pruning, and the computation is terminated */
+    if (sr_args.committor) {
+        set<const Node*> nodes_trap; // nodes not in A or B from which B cannot be reached
+        for (const Node &node: ktn.nodes) {
+            if (node.aorb==0 && !toB[node.node_pos]) nodes_trap.insert(&node); }
+        vector<bool> to_trap = ktn.get_reachable(nodes_trap,false,ktn.nodesB);
+        for (const Node &node: ktn.nodes) {
+            if (node.aorb!=0 || toA[node.node_pos] || !toB[node.node_pos] || !to_trap[node.node_pos]) continue;
+            cout << "kps> error: node " << node.node_id << " cannot reach A, but can reach both B and a closed class of nodes that" \
+                 << " does not contain B, so its B<-A committor probability cannot be determined" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    int n_pruned=0;
+    for (const Node &node: ktn.nodes) {
+        if (node.aorb==-1 || toA[node.node_pos]) continue;
+        gt.eliminated[node.node_pos]=true; n_pruned++; }
+    /* the remaining nodes not in A are partitioned into independent components (connected components of the network with the
+       nodes of A and the pruned nodes removed), which are transformed in parallel */
+    vector<int> comp_ids(ktn.n_nodes,-1);
+    vector<vector<int>> comps;
+    for (const Node &node: ktn.nodes) {
+        if (gt.eliminated[node.node_pos] || comp_ids[node.node_pos]>=0) continue;
+        comps.push_back(vector<int>());
+        queue<int> nbr_queue; nbr_queue.push(node.node_pos); comp_ids[node.node_pos]=comps.size()-1;
+        while (!nbr_queue.empty()) {
+            int i=nbr_queue.front(); nbr_queue.pop();
+            comps.back().push_back(i);
+            for (const auto &elem: gt.rows[i]) {
+                if (gt.eliminated[elem.first] || comp_ids[elem.first]>=0) continue;
+                comp_ids[elem.first]=comps.size()-1; nbr_queue.push(elem.first); }
+        }
+    }
+    sort(comps.begin(),comps.end(),[](const vector<int> &l,const vector<int> &r) { return l.size()>r.size(); });
+    cout << "kps> no. of pruned nodes (from which A cannot be reached): " << n_pruned << "   no. of independent components: " \
+         << comps.size() << endl;
+    ofstream scratch_f;
+    if (sr_args.memlimit>0.) scratch_f.open(scratch_fname,ios::binary|ios::trunc);
+    if (sr_args.memlimit>0. && !scratch_f.is_open()) {
+        cout << "kps> fatal error: could not open scratch file " << scratch_fname << endl; exit(EXIT_FAILURE); }
+    vector<vector<pair<streamoff,int>>> chunks(comps.size()); // offsets in scratch file and numbers of factors for chunks of factors
+    vector<vector<GT_factor>> factors(comps.size()); // buffers of factors that have not been written to the scratch file
+    long long int nnz=0; // total size of the active network
+    for (const auto &row: gt.rows) nnz+=row.size();
+    double peak_bytes=0.;
+    bool warned=false;
+    #pragma omp parallel for schedule(dynamic)
+    for (int c=0;c<static_cast<int>(comps.size());c++) {
+        double buffer_bytes=0.;
+        /* eliminate the nodes of the set I (i.e. not in A or B) first if committor probabilities are to be computed, then the
+           nodes of B. Otherwise, all nodes not in A are eliminated together */
+        for (int phase=0;phase<2;phase++) {
+            if (phase==1 && !sr_args.mfpt) break; // nodes of B need not be eliminated
+            priority_queue<pair<int,int>,vector<pair<int,int>>,greater<pair<int,int>>> gt_pq;
+            for (int i: comps[c]) {
+                bool in_phase = sr_args.committor?((ktn.nodes[i].aorb==1)==(phase==1)):(phase==0);
+                if (in_phase) gt_pq.push(make_pair(gt.rows[i].size(),i));
+            }
+            while (!gt_pq.empty()) {
+                pair<int,int> elem=gt_pq.top(); gt_pq.pop();
+                if (gt.eliminated[elem.second]) continue;
+                if (elem.first!=static_cast<int>(gt.rows[elem.second].size())) { // degree has changed since the node was queued
+                    gt_pq.push(make_pair(gt.rows[elem.second].size(),elem.second)); continue; }
+                long long int dnnz=KPS::gt_sparse_iteration(gt,elem.second,factors[c],sr_args.fptmoments);
+                buffer_bytes+=sizeof(GT_factor)+((factors[c].back().row.size()+factors[c].back().col.size())* \
+                              sizeof(pair<int,long double>));
+                long long int nnz_curr;
+                #pragma omp atomic capture
+                { nnz+=dnnz; nnz_curr=nnz; }
+                double active_bytes=(nnz_curr*elem_bytes)+(ktn.n_nodes*node_bytes);
+                if (active_bytes>peak_bytes || (active_bytes>memlimit_bytes && !warned)) {
+                    #pragma omp critical(outofcore_mem)
+                    {
+                    peak_bytes=max(peak_bytes,active_bytes);
+                    if (active_bytes>memlimit_bytes && !warned) {
+                        cout << "kps> warning: memory for the active network exceeds MEMLIMIT, factors are written to file after every elimination" << endl;
+                        warned=true; }
+                    }
+                }
+                // flush the buffer of factors to the scratch file (the memory limit is shared between the buffers of all threads)
+                if (active_bytes+(buffer_bytes*omp_get_num_threads())>memlimit_bytes) {
+                    #pragma omp critical(outofcore_scratch)
+                    {
+                    chunks[c].push_back(make_pair(static_cast<streamoff>(scratch_f.tellp()),factors[c].size()));
+                    KPS::write_gt_factors(scratch_f,factors[c]);
+                    }
+                    factors[c].clear(); buffer_bytes=0.;
+                }
+            }
+        }
+    }
+    scratch_f.close();
+    int n_chunks=0;
+    for (const auto &comp_chunks: chunks) n_chunks+=comp_chunks.size();
+    cout << "kps> finished forward pass of graph transformation. Peak memory of active network: " << peak_bytes/(1024.*1024.) \
+         << " MB   no. of chunks of factors written to scratch file: " << n_chunks << endl;
+    /* back-substitution phase, processing the factors in reverse order of elimination. The MFPT and committor probability for
+       a node are m_x = (tau_x + sum_z T_xz m_z)/(1-T_xx) and q_x = (pabs_x + sum_z T_xz q_z)/(1-T_xx), respectively, where z
+       denotes nodes that were noneliminated at the point of elimination of node x. The absorbing set is A (m=0, q_AB=1, q_BA=0)
+       and, for the committor probabilities, B is a boundary (q_AB=0, q_BA=1). Pruned nodes from which B can be reached have
+       q_BA=1, since neither A nor a closed class not containing B can be reached from these nodes (as checked above) */
+    vector<long double> mfpt_allvals(ktn.n_nodes,0.L), q_ab_vals(ktn.n_nodes,0.L), q_ba_vals(ktn.n_nodes,0.L);
+    vector<long double> fpt2_vals, fpt3_vals; // second and third moments of the first passage time distribution
+    if (sr_args.fptmoments) { fpt2_vals.resize(ktn.n_nodes,0.L); fpt3_vals.resize(ktn.n_nodes,0.L); }
+    for (const Node &node: ktn.nodes) {
+        if (node.aorb==-1) { q_ab_vals[node.node_pos]=1.L;
+        } else if (node.aorb==1) { q_ba_vals[node.node_pos]=1.L; }
+        if (node.aorb!=-1 && !toA[node.node_pos]) {
+            if (toB[node.node_pos]) q_ba_vals[node.node_pos]=1.L;
+            mfpt_allvals[node.node_pos]=numeric_limits<long double>::infinity();
+            if (sr_args.fptmoments) {
+                fpt2_vals[node.node_pos]=numeric_limits<long double>::infinity();
+                fpt3_vals[node.node_pos]=numeric_limits<long double>::infinity(); }
+        }
+    }
+    /* apply the function op to each factor of the c-th component, in order of elimination (if fwd) or in reverse order, reading
+       the chunks of factors that were written to the scratch file as necessary */
+    auto sweep_factors = [&](int c, bool fwd, const function<void(const GT_factor&)> &op) {
+        if (!fwd) { for (vector<GT_factor>::const_reverse_iterator it_fac=factors[c].rbegin();it_fac!=factors[c].rend();++it_fac) op(*it_fac); }
+        if (!chunks[c].empty()) {
+            ifstream scratch_in(scratch_fname,ios::binary);
+            vector<GT_factor> factors_chunk;
+            int nchunks=chunks[c].size();
+            for (int k=0;k<nchunks;k++) {
+                const pair<streamoff,int> &chunk=chunks[c][fwd?k:nchunks-1-k];
+                scratch_in.seekg(chunk.first);
+                KPS::read_gt_factors(scratch_in,factors_chunk,chunk.second);
+                if (fwd) { for (const GT_factor &fac: factors_chunk) op(fac);
+                } else { for (vector<GT_factor>::const_reverse_iterator it_fac=factors_chunk.rbegin();it_fac!=factors_chunk.rend();++it_fac) op(*it_fac); }
+            }
+            scratch_in.close();
+        }
+        if (fwd) { for (const GT_factor &fac: factors[c]) op(fac); }
+    };
+    auto back_substitute = [&](const GT_factor &fac) {
+        if (sr_args.mfpt) {
+            long double val=fac.tau;
+            for (const auto &elem: fac.row) { // transitions with zero probability to pruned nodes do not contribute
+                if (elem.second>0.L) val+=elem.second*mfpt_allvals[elem.first]; }
+            mfpt_allvals[fac.node]=val/fac.factor;
+        }
+        if (sr_args.committor && ktn.nodes[fac.node].aorb==0) {
+            long double q_ab=fac.pabs, q_ba=0.L;
+            for (const auto &elem: fac.row) {
+                q_ab+=elem.second*q_ab_vals[elem.first]; q_ba+=elem.second*q_ba_vals[elem.first]; }
+            q_ab_vals[fac.node]=q_ab/fac.factor; q_ba_vals[fac.node]=q_ba/fac.factor;
+        }
+    };
+    /* the k-th moment of the first passage time distribution satisfies the same linear equations as the MFPT (k=1), with the
+       mean waiting times tau_x replaced by a vector given by the lower moments. For waiting times that are exponentially
+       distributed (CTMC), this vector is k*tau_x*m^{(k-1)}_x. For waiting times of fixed duration (DTMC) the vector elements
+       are 2*tau_x*m_x-tau_x^2 (k=2) and 3*tau_x*m^{(2)}_x-3*tau_x^2*m_x+tau_x^3 (k=3) */
+    auto fpt_moment_rhs = [&](int i, int k) {
+        long double tau=ktn.nodes[i].t_esc, m1=mfpt_allvals[i];
+        if (isinf(m1)) return numeric_limits<long double>::infinity();
+        if (!discretetime) return static_cast<long double>(k)*tau*((k==2)?m1:fpt2_vals[i]);
+        if (k==2) return (2.L*tau*m1)-(tau*tau);
+        return (3.L*tau*fpt2_vals[i])-(3.L*tau*tau*m1)+(tau*tau*tau);
+    };
+    #pragma omp parallel for schedule(dynamic)
+    for (int c=0;c<static_cast<int>(comps.size());c++) {
+        sweep_factors(c,false,back_substitute);
+        if (sr_args.fptmoments) {
+            for (int k=2;k<=3;k++) {
+                vector<long double> &fpt_vals=(k==2)?fpt2_vals:fpt3_vals;
+                for (int i: comps[c]) fpt_vals[i]=fpt_moment_rhs(i,k);
+                // forward substitution: renormalise the right-hand side vector as for the mean waiting times during elimination
+                sweep_factors(c,true,[&fpt_vals](const GT_factor &fac) {
+                    for (const auto &elem: fac.col) fpt_vals[elem.first]+=elem.second*fpt_vals[fac.node]; });
+                // back-substitution, as for the MFPTs
+                sweep_factors(c,false,[&fpt_vals](const GT_factor &fac) {
+                    long double val=fpt_vals[fac.node];
+                    for (const auto &elem: fac.row) {
+                        if (elem.second>0.L) val+=elem.second*fpt_vals[elem.first]; }
+                    fpt_vals[fac.node]=val/fac.factor; });
+            }
+        }
+        vector<GT_factor>().swap(factors[c]);
+    }
+    if (sr_args.memlimit>0.) remove(scratch_fname.c_str());
+    if (sr_args.committor) { // committor probabilities for nodes of the endpoint sets
+        for (const Node &node: ktn.nodes) {
+            if (node.aorb==-1) { q_ba_vals[node.node_pos]=KPS::committor_boundary_node(ktn,node.node_id,q_ba_vals,-1);
+            } else if (node.aorb==1) { q_ab_vals[node.node_pos]=KPS::committor_boundary_node(ktn,node.node_id,q_ab_vals,1); }
+        }
+        Wrapper_Method::write_vec<long double>(q_ab_vals,"committor_AB.dat");
+        Wrapper_Method::write_vec<long double>(q_ba_vals,"committor_BA.dat");
+        cout << "kps> finished writing committor probabilities to files" << endl;
+        if (sr_args.tpt) calc_tpt(ktn,q_ab_vals,q_ba_vals);
+    }
+    if (sr_args.mfpt) {
+        vector<long double> init_probs=KPS::get_init_probs(ktn);
+        ofstream mfpt_f; mfpt_f.open("mfpt.dat"); mfpt_f.setf(ios::scientific,ios::floatfield);
+        mfpt_f.precision(10);
+        long double mfpt_ab=0.L;
+        for (const Node &node: ktn.nodes) {
+            if (node.aorb==-1) continue;
+            if (init_probs[node.node_pos]>0.L) mfpt_ab+=init_probs[node.node_pos]*mfpt_allvals[node.node_pos];
+            mfpt_f << setw(5) << node.node_id << setw(18) << mfpt_allvals[node.node_pos] << endl;
+        }
+        cout << "kps> the A<-B MFPT is:" << string(10,' ') << setw(18) << scientific << setprecision(10) << mfpt_ab << endl;
+        cout << "kps> finished writing MFPTs to file" << endl;
+    }
+    if (sr_args.fptmoments) {
+        vector<long double> init_probs=KPS::get_init_probs(ktn);
+        ofstream moments_f; moments_f.open("fpt_moments.dat"); moments_f.setf(ios::scientific,ios::floatfield);
+        moments_f.precision(10);
+        long double fpt2_ab=0.L, fpt3_ab=0.L, mfpt_ab=0.L;
+        for (const Node &node: ktn.nodes) {
+            if (node.aorb==-1) continue;
+            int i=node.node_pos;
+            if (init_probs[i]>0.L) {
+                mfpt_ab+=init_probs[i]*mfpt_allvals[i]; fpt2_ab+=init_probs[i]*fpt2_vals[i]; fpt3_ab+=init_probs[i]*fpt3_vals[i]; }
+            moments_f << setw(5) << node.node_id << setw(18) << mfpt_allvals[i] << setw(18) << fpt2_vals[i] \
+                      << setw(18) << fpt3_vals[i] << endl;
+        }
+        cout << "kps> the second and third moments of the A<-B FPT distribution are:" << setw(18) << scientific << setprecision(10) \
+             << fpt2_ab << setw(18) << fpt3_ab << endl;
+        cout << "kps> the standard deviation of the A<-B FPT distribution is:" << setw(18) << sqrt(fpt2_ab-(mfpt_ab*mfpt_ab)) << endl;
+        cout << "kps> finished writing moments of the FPT distribution to file" << endl;
+    }
+}
+
+/* get the initial occupation probabilities of the nodes in B (for a single node, from the specified initial condition, or a
+   local equilibrium within B). Elements of the returned vector for nodes not in B are zero */
+vector<long double> KPS::get_init_probs(const Network &ktn) {
+    vector<long double> init_probs(ktn.n_nodes,0.L);
+    if (ktn.nodesB.size()==1) {
+        init_probs[(*ktn.nodesB.begin())->node_pos]=1.L;
+    } else {
+        long double pi_B=0.L; int i=0;
+        for (const Node *nodeptr: ktn.nodesB) pi_B+=exp(nodeptr->pi);
+        for (const Node *nodeptr: ktn.nodesB) {
+            init_probs[nodeptr->node_pos] = ktn.initcond?ktn.init_probs[i]:exp(nodeptr->pi)/pi_B; i++; }
+    }
+    return init_probs;
+}
+
+/* write a chunk of factors from graph transformation to a binary file */
+void KPS::write_gt_factors(ofstream &fac_f, const vector<GT_factor> &factors) {
+    for (const GT_factor &fac: factors) {
+        int nrow=fac.row.size(), ncol=fac.col.size();
+        fac_f.write(reinterpret_cast<const char*>(&fac.node),sizeof(int));
+        fac_f.write(reinterpret_cast<const char*>(&fac.tau),sizeof(long double));
+        fac_f.write(reinterpret_cast<const char*>(&fac.factor),sizeof(long double));
+        fac_f.write(reinterpret_cast<const char*>(&fac.pabs),sizeof(long double));
+        fac_f.write(reinterpret_cast<const char*>(&nrow),sizeof(int));
+        fac_f.write(reinterpret_cast<const char*>(&ncol),sizeof(int));
+        for (const auto &elem: fac.row) {
+            fac_f.write(reinterpret_cast<const char*>(&elem.first),sizeof(int));
+            fac_f.write(reinterpret_cast<const char*>(&elem.second),sizeof(long double));
+        }
+        for (const auto &elem: fac.col) {
+            fac_f.write(reinterpret_cast<const char*>(&elem.first),sizeof(int));
+            fac_f.write(reinterpret_cast<const char*>(&elem.second),sizeof(long double));
+        }
+    }
+    if (!fac_f.good()) {
+        cout << "kps> fatal error: failed to write factors to scratch file" << endl; exit(EXIT_FAILURE); }
+}
+
+/* read a chunk of nfactors factors from graph transformation from a binary file, at the current position */
+void KPS::read_gt_factors(ifstream &fac_f, vector<GT_factor> &factors, int nfactors) {
+    factors.resize(nfactors);
+    for (GT_factor &fac: factors) {
+        int nrow, ncol;
+        fac_f.read(reinterpret_cast<char*>(&fac.node),sizeof(int));
+        fac_f.read(reinterpret_cast<char*>(&fac.tau),sizeof(long double));
+        fac_f.read(reinterpret_cast<char*>(&fac.factor),sizeof(long double));
+        fac_f.read(reinterpret_cast<char*>(&fac.pabs),sizeof(long double));
+        fac_f.read(reinterpret_cast<char*>(&nrow),sizeof(int));
+        fac_f.read(reinterpret_cast<char*>(&ncol),sizeof(int));
+        fac.row.resize(nrow); fac.col.resize(ncol);
+        for (auto &elem: fac.row) {
+            fac_f.read(reinterpret_cast<char*>(&elem.first),sizeof(int));
+            fac_f.read(reinterpret_cast<char*>(&elem.second),sizeof(long double));
+        }
+        for (auto &elem: fac.col) {
+            fac_f.read(reinterpret_cast<char*>(&elem.first),sizeof(int));
+            fac_f.read(reinterpret_cast<char*>(&elem.second),sizeof(long double));
+        }
+    }
+    if (!fac_f.good()) {
+        cout << "kps> fatal error: failed to read factors from scratch file" << endl; exit(EXIT_FAILURE); }
+}
+
 /* write the elements of the vector of MFPTs to the absorbing state. NB At this point, pi values of the ktn_kps
    object should, for initial nodes, have been overwritten to the initial probability distribution values */
 void KPS::calc_mfpt() {
@@ -190,7 +831,6 @@ void KPS::write_renormalised_probs(string fname) {
     elems_f.setf(ios::right,ios::adjustfield); elems_f.setf(ios::scientific,ios::floatfield);
     elems_f.precision(10);
     for (vector<Node>::iterator it_nodevec=ktn_kps->nodes.begin();it_nodevec!=ktn_kps->nodes.end();++it_nodevec) {
-        if (sr_args.fundamentalred && !it_nodevec->flag) continue;
         if (!it_nodevec->eliminated && it_nodevec->aorb!=-1) { // print self-loop of non-absorbing node if node is non-eliminated
             elems_f << setw(5) << it_nodevec->node_id << setw(5) << it_nodevec->node_id << setw(18) << it_nodevec->t << endl;
         }
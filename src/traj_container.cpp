@@ -0,0 +1,233 @@
+/*
+File containing functions to write and read the indexed binary container of trajectory data
+
+This file is a part of DISCOTRESS, a software package to simulate the dynamics on arbitrary continuous- and discrete-time Markov chains (CTMCs and DTMCs).
+Copyright (C) 2020 Daniel J. Sharpe
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "traj_container.h"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+
+const char Traj_container::magic[9]="DSCTRAJ1";
+const char Traj_container::index_magic[9]="DSCTIDX1";
+Traj_container *Traj_container::active=nullptr;
+
+static const size_t fixed_record_size=2*sizeof(int32_t)+1+sizeof(uint64_t)+3*sizeof(double);
+static const size_t index_entry_size=2*sizeof(int32_t)+1+sizeof(uint32_t)+2*sizeof(uint64_t);
+static const size_t header_size=8+2*sizeof(uint32_t);
+static const size_t footer_size=2*sizeof(uint64_t)+8;
+
+/* append the raw bytes of a value (in native byte order) to a buffer */
+template <typename T>
+static void put_raw(string &buf, T val) {
+    buf.append(reinterpret_cast<const char*>(&val),sizeof(T));
+}
+
+template <typename T>
+static T get_raw(const char *&pos) {
+    T val; memcpy(&val,pos,sizeof(T)); pos+=sizeof(T);
+    return val;
+}
+
+static void put_varint(string &buf, uint64_t val) {
+    while (val>=0x80) { buf.push_back(static_cast<char>((val&0x7f)|0x80)); val>>=7; }
+    buf.push_back(static_cast<char>(val));
+}
+
+static uint64_t get_varint(const char *&pos, const char *end) {
+    uint64_t val=0;
+    for (int shift=0;pos<end && shift<64;shift+=7) {
+        unsigned char byte=static_cast<unsigned char>(*pos++);
+        val|=static_cast<uint64_t>(byte&0x7f)<<shift;
+        if (!(byte&0x80)) return val;
+    }
+    cout << "traj_container> error: corrupt compressed block" << endl; exit(EXIT_FAILURE);
+}
+
+/* zigzag encoding maps signed differences of small magnitude to small unsigned integers */
+static uint64_t zigzag(int64_t val) { return (static_cast<uint64_t>(val)<<1)^static_cast<uint64_t>(val>>63); }
+static int64_t unzigzag(uint64_t val) { return static_cast<int64_t>(val>>1)^-static_cast<int64_t>(val&1); }
+
+static uint64_t double_bits(double val) { uint64_t bits; memcpy(&bits,&val,sizeof(double)); return bits; }
+static double bits_double(uint64_t bits) { double val; memcpy(&val,&bits,sizeof(double)); return val; }
+
+Traj_container::Traj_container(const string &fname, bool compress) {
+    cout << "traj_container> writing trajectory data to the container file " << fname << (compress?" (compressed)":"") << endl;
+    this->compress=compress;
+    f.open(fname,ios_base::binary|ios_base::trunc);
+    if (!f.is_open()) { cout << "traj_container> error: could not open file " << fname << endl; exit(EXIT_FAILURE); }
+    string header(magic,8);
+    put_raw<uint32_t>(header,version); put_raw<uint32_t>(header,compress?1:0);
+    f.write(header.data(),header.size());
+    offset=header.size();
+    omp_init_lock(&lock);
+}
+
+Traj_container::~Traj_container() {
+    string index_buf;
+    for (const Traj_container_block &block: index) {
+        put_raw<int32_t>(index_buf,block.walker_id); put_raw<int32_t>(index_buf,block.path_no);
+        index_buf.push_back(block.newpath?1:0); put_raw<uint32_t>(index_buf,block.nrecords);
+        put_raw<uint64_t>(index_buf,block.offset); put_raw<uint64_t>(index_buf,block.nbytes);
+    }
+    put_raw<uint64_t>(index_buf,offset); put_raw<uint64_t>(index_buf,index.size());
+    index_buf.append(index_magic,8);
+    f.write(index_buf.data(),index_buf.size());
+    f.close();
+    omp_destroy_lock(&lock);
+    cout << "traj_container> wrote " << index.size() << " blocks of trajectory data" << endl;
+}
+
+/* encode a chunk of records (outside of the lock) and append the block to the container file */
+void Traj_container::write_block(int walker_id, int path_no, bool newpath, const vector<Traj_container_record> &records) {
+    if (records.empty()) return;
+    string buf;
+    encode_records(records,compress,buf);
+    omp_set_lock(&lock);
+    index.push_back({walker_id:walker_id,path_no:path_no,newpath:newpath,nrecords:static_cast<uint32_t>(records.size()), \
+        offset:offset,nbytes:buf.size()});
+    f.write(buf.data(),buf.size());
+    offset+=buf.size();
+    omp_unset_lock(&lock);
+}
+
+void Traj_container::encode_records(const vector<Traj_container_record> &records, bool compress, string &buf) {
+    if (!compress) {
+        buf.reserve(records.size()*fixed_record_size);
+        for (const Traj_container_record &record: records) {
+            put_raw<int32_t>(buf,record.node_id); put_raw<int32_t>(buf,record.comm_id); buf.push_back(record.intvl?1:0);
+            put_raw<uint64_t>(buf,record.k); put_raw<double>(buf,record.t); put_raw<double>(buf,record.p); put_raw<double>(buf,record.s);
+        }
+        return;
+    }
+    Traj_container_record prev{node_id:0,comm_id:0,intvl:false,k:0,t:0.,p:0.,s:0.};
+    for (const Traj_container_record &record: records) {
+        buf.push_back(record.intvl?1:0);
+        put_varint(buf,zigzag(static_cast<int64_t>(record.node_id)-prev.node_id));
+        put_varint(buf,zigzag(static_cast<int64_t>(record.comm_id)-prev.comm_id));
+        put_varint(buf,zigzag(static_cast<int64_t>(record.k-prev.k)));
+        put_varint(buf,double_bits(record.t)^double_bits(prev.t));
+        put_varint(buf,double_bits(record.p)^double_bits(prev.p));
+        put_varint(buf,double_bits(record.s)^double_bits(prev.s));
+        prev=record;
+    }
+}
+
+Traj_container_chunk::Traj_container_chunk(int walker_id, int path_no, bool newpath) {
+    this->walker_id=walker_id; this->path_no=path_no; this->newpath=newpath;
+    records.reserve(Traj_container::chunk_size);
+}
+
+Traj_container_chunk::~Traj_container_chunk() { flush(); }
+
+void Traj_container_chunk::add_record(const Traj_container_record &record) {
+    records.push_back(record);
+    if (records.size()>=Traj_container::chunk_size) flush();
+}
+
+/* write the buffered records as a block of the container, subsequent blocks continue the same trajectory */
+void Traj_container_chunk::flush() {
+    if (records.empty() || Traj_container::active==nullptr) return;
+    Traj_container::active->write_block(walker_id,path_no,newpath,records);
+    records.clear(); newpath=false;
+}
+
+/* open a container file and read its index */
+Traj_container_reader::Traj_container_reader(const string &fname) {
+    f.open(fname,ios_base::binary);
+    if (!f.is_open()) { cout << "traj_container> error: could not open file " << fname << endl; exit(EXIT_FAILURE); }
+    char header[header_size];
+    f.read(header,header_size);
+    if (!f || memcmp(header,Traj_container::magic,8)!=0) {
+        cout << "traj_container> error: " << fname << " is not a trajectory container file" << endl; exit(EXIT_FAILURE); }
+    const char *pos=header+8;
+    uint32_t version=get_raw<uint32_t>(pos), flags=get_raw<uint32_t>(pos);
+    if (version!=Traj_container::version) {
+        cout << "traj_container> error: unsupported container version " << version << endl; exit(EXIT_FAILURE); }
+    compress=flags&1;
+    char footer[footer_size];
+    f.seekg(-static_cast<streamoff>(footer_size),ios_base::end);
+    f.read(footer,footer_size);
+    if (!f || memcmp(footer+2*sizeof(uint64_t),Traj_container::index_magic,8)!=0) {
+        cout << "traj_container> error: container file " << fname << " has no index (the simulation did not finish)" << endl;
+        exit(EXIT_FAILURE); }
+    pos=footer;
+    uint64_t index_offset=get_raw<uint64_t>(pos), nblocks=get_raw<uint64_t>(pos);
+    vector<char> index_buf(nblocks*index_entry_size);
+    f.seekg(index_offset);
+    f.read(index_buf.data(),index_buf.size());
+    pos=index_buf.data();
+    for (uint64_t i=0;i<nblocks;i++) {
+        Traj_container_block block;
+        block.walker_id=get_raw<int32_t>(pos); block.path_no=get_raw<int32_t>(pos);
+        block.newpath=get_raw<char>(pos)!=0; block.nrecords=get_raw<uint32_t>(pos);
+        block.offset=get_raw<uint64_t>(pos); block.nbytes=get_raw<uint64_t>(pos);
+        index.push_back(block);
+    }
+}
+
+vector<Traj_container_record> Traj_container_reader::read_block(const Traj_container_block &block) {
+    vector<char> buf(block.nbytes);
+    f.seekg(block.offset);
+    f.read(buf.data(),buf.size());
+    if (!f) { cout << "traj_container> error: could not read block of container file" << endl; exit(EXIT_FAILURE); }
+    vector<Traj_container_record> records;
+    decode_records(buf.data(),buf.size(),block.nrecords,compress,records);
+    return records;
+}
+
+vector<Traj_container_block> Traj_container_reader::find_blocks(int walker_id, int path_no) const {
+    vector<Traj_container_block> blocks;
+    for (const Traj_container_block &block: index) {
+        if (block.walker_id==walker_id && block.path_no==path_no) blocks.push_back(block);
+    }
+    return blocks;
+}
+
+void Traj_container_reader::decode_records(const char *buf, size_t nbytes, uint32_t nrecords, bool compress, \
+                                           vector<Traj_container_record> &records) {
+    const char *pos=buf, *end=buf+nbytes;
+    records.reserve(records.size()+nrecords);
+    if (!compress) {
+        if (nbytes!=nrecords*fixed_record_size) {
+            cout << "traj_container> error: corrupt block" << endl; exit(EXIT_FAILURE); }
+        for (uint32_t i=0;i<nrecords;i++) {
+            Traj_container_record record;
+            record.node_id=get_raw<int32_t>(pos); record.comm_id=get_raw<int32_t>(pos); record.intvl=get_raw<char>(pos)!=0;
+            record.k=get_raw<uint64_t>(pos); record.t=get_raw<double>(pos); record.p=get_raw<double>(pos); record.s=get_raw<double>(pos);
+            records.push_back(record);
+        }
+        return;
+    }
+    Traj_container_record prev{node_id:0,comm_id:0,intvl:false,k:0,t:0.,p:0.,s:0.};
+    for (uint32_t i=0;i<nrecords;i++) {
+        if (pos>=end) { cout << "traj_container> error: corrupt compressed block" << endl; exit(EXIT_FAILURE); }
+        Traj_container_record record;
+        record.intvl=*pos++!=0;
+        record.node_id=prev.node_id+unzigzag(get_varint(pos,end));
+        record.comm_id=prev.comm_id+unzigzag(get_varint(pos,end));
+        record.k=prev.k+static_cast<uint64_t>(unzigzag(get_varint(pos,end)));
+        record.t=bits_double(get_varint(pos,end)^double_bits(prev.t));
+        record.p=bits_double(get_varint(pos,end)^double_bits(prev.p));
+        record.s=bits_double(get_varint(pos,end)^double_bits(prev.s));
+        records.push_back(record);
+        prev=record;
+    }
+}
@@ -0,0 +1,111 @@
+/*
+File containing classes to write and read the indexed binary container of trajectory data, which replaces the individual
+walker.x.y.dat files
+
+The container file comprises a header (magic string, version, flags), a sequence of blocks, each of which contains the records
+for a contiguous chunk of a single trajectory (identified by walker ID and path no.), and an index of the blocks, followed by a
+footer (offset and length of the index, magic string). Records are either fixed-width, or compressed: the node and community IDs
+and path length are stored as zigzag varints of their differences from the previous record of the block, and the path time,
+action and entropy flow are stored as varints of the XOR of their bit patterns with those of the previous record.
+
+This file is a part of DISCOTRESS, a software package to simulate the dynamics on arbitrary continuous- and discrete-time Markov chains (CTMCs and DTMCs).
+Copyright (C) 2020 Daniel J. Sharpe
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __TRAJ_CONTAINER_H_INCLUDED__
+#define __TRAJ_CONTAINER_H_INCLUDED__
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <omp.h>
+
+using namespace std;
+
+/* a single line of trajectory data, as written to a walker.x.y.dat file */
+struct Traj_container_record {
+    int32_t node_id, comm_id;
+    bool intvl;                 // trajectory data dumped at a time interval, path action and entropy flow are not written
+    uint64_t k;                 // path length
+    double t, p, s;             // path time, action and entropy flow
+};
+
+/* entry of the index of the container, for a single block of records */
+struct Traj_container_block {
+    int32_t walker_id, path_no;
+    bool newpath;               // block begins a new trajectory (c.f. the newpath argument of Walker::dump_walker_info())
+    uint32_t nrecords;
+    uint64_t offset, nbytes;    // position and size of the block in the container file
+};
+
+/* writer for the container, which is shared by all threads */
+class Traj_container {
+
+    private:
+
+    ofstream f;
+    bool compress;
+    uint64_t offset;            // current size of the file
+    vector<Traj_container_block> index;
+    omp_lock_t lock;
+
+    public:
+
+    static const char magic[9], index_magic[9];
+    static const uint32_t version=1;
+    static const size_t chunk_size=4096; // max. no. of records buffered for a trajectory before a block is written
+
+    Traj_container(const string&,bool);
+    ~Traj_container(); // writes the index and footer
+    void write_block(int,int,bool,const vector<Traj_container_record>&);
+    static void encode_records(const vector<Traj_container_record>&,bool,string&);
+    static Traj_container *active; // the container to which trajectory data is written (nullptr if walker files are written)
+};
+
+/* records of the trajectory currently being written by a walker, which are written to the container as a block when the chunk
+   is full, when the walker is reset or starts a new path, or when the chunk is destroyed */
+struct Traj_container_chunk {
+    int walker_id, path_no;
+    bool newpath;
+    vector<Traj_container_record> records;
+
+    Traj_container_chunk(int,int,bool);
+    ~Traj_container_chunk();
+    void add_record(const Traj_container_record&);
+    void flush();
+};
+
+/* reader for the container, with random access to the blocks of any trajectory via the index */
+class Traj_container_reader {
+
+    private:
+
+    ifstream f;
+    bool compress;
+
+    public:
+
+    vector<Traj_container_block> index;
+
+    Traj_container_reader(const string&);
+    vector<Traj_container_record> read_block(const Traj_container_block&);
+    vector<Traj_container_block> find_blocks(int,int) const; // blocks of a given trajectory, in the order that they were written
+    static void decode_records(const char*,size_t,uint32_t,bool,vector<Traj_container_record>&);
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+Tool to export trajectory data from the binary container file (written by DISCOTRESS when the TRAJCONTAINER keyword is set) to
+the legacy walker.x.y.dat text files.
+
+Usage: traj_export [container file (default walker_trajs.bin)] [walker ID] [path no.]
+If a walker ID and path no. are given, only the file for that trajectory is written, otherwise all trajectories are exported.
+Compile using:
+g++ -std=c++17 traj_export.cpp traj_container.cpp -o traj_export -fopenmp
+
+This file is a part of DISCOTRESS, a software package to simulate the dynamics on arbitrary continuous- and discrete-time Markov chains (CTMCs and DTMCs).
+Copyright (C) 2020 Daniel J. Sharpe
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "traj_container.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* write a block of records to the corresponding walker file, in the same format as Walker::dump_walker_info() */
+void export_block(Traj_container_reader &reader, const Traj_container_block &block) {
+    string walker_fname="walker."+to_string(block.walker_id)+"."+to_string(block.path_no)+".dat";
+    ofstream walker_f(walker_fname,block.newpath?ios_base::trunc:ios_base::app);
+    walker_f.setf(ios::right,ios::adjustfield); walker_f.setf(ios::scientific,ios::floatfield);
+    walker_f.precision(10);
+    for (const Traj_container_record &record: reader.read_block(block)) {
+        walker_f << setw(7) << record.node_id << setw(7) << record.comm_id;
+        walker_f << setw(25) << static_cast<long double>(record.t) << setw(30) << record.k;
+        if (!record.intvl) walker_f << setw(25) << static_cast<long double>(record.p) << setw(25) << static_cast<long double>(record.s);
+        walker_f << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+
+    string fname = argc>1?argv[1]:"walker_trajs.bin";
+    if (argc!=2 && argc!=4 && argc!=1) {
+        cout << "traj_export> usage: traj_export [container file] [walker ID] [path no.]" << endl; exit(EXIT_FAILURE); }
+    Traj_container_reader reader(fname);
+    vector<Traj_container_block> blocks;
+    if (argc==4) {
+        blocks = reader.find_blocks(stoi(argv[2]),stoi(argv[3]));
+        if (blocks.empty()) {
+            cout << "traj_export> error: trajectory not found in container" << endl; exit(EXIT_FAILURE); }
+    } else {
+        blocks = reader.index;
+    }
+    for (const Traj_container_block &block: blocks) export_block(reader,block);
+    cout << "traj_export> exported " << blocks.size() << " blocks of trajectory data from " << fname << endl;
+    return 0;
+}
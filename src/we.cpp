@@ -26,35 +26,144 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "kmc_methods.h"
 #include <omp.h>
 #include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
 
 using namespace std;
 
-WE::WE(const Network &ktn, double taure, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+WE::WE(const Network &ktn, double taure, const vector<int> &commstargs, bool discretetime, \
+       const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
 
     cout << "wekmc> running WE-kMC with parameters:\n  resampling time: " << taure << " \tno. of communities: " \
-         << ktn.ncomms << endl;
-    this->taure=taure;
+         << ktn.ncomms << " \tinitial no. of walkers: " << walkers.size() << endl;
+    this->taure=taure; this->commstargs=commstargs; this->discretetime=discretetime;
+    // initially, all walkers are in the initial state B and have equal weights
+    for (int i=0;i<static_cast<int>(walkers.size());i++) {
+        Task_rng task_rng(seed,-1,i);
+        walkers[i].walker_id=i; walkers[i].weight=1.L/static_cast<long double>(walkers.size());
+        get_initial_node(ktn,walkers[i],seed);
+    }
 }
 
 WE::~WE() {}
 
+/* main loop of WE-kMC. In each iteration, the walkers are propagated in parallel until the next resampling time, and are then
+   resampled so that each community is occupied by its target number of walkers. Walkers that reach the absorbing state A are
+   recycled to the initial state B, so that the ensemble relaxes to a nonequilibrium steady state, and the weight that flows into
+   A per unit time yields the A<-B rate constant */
 void WE::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
     cout << "wekmc> beginning WE-kMC simulation" << endl;
     n_ab=0; int n_wekmcit=0;
     long double tau_r=static_cast<long double>(taure); // next resampling time
+    ofstream flux_f; flux_f.open("we_flux.dat");
+    flux_f.setf(ios::right,ios::adjustfield); flux_f.setf(ios::scientific,ios::floatfield);
+    flux_f.precision(10);
     while ((n_ab<nabpaths) and (n_wekmcit<maxit)) { // algorithm terminates when max. no. of iterations of resampling procedure have been performed
-        for (auto &walker: walkers) {
-//            if (!walker.active) continue;
-//            while (walker.t<tau_r) // quack simulate
+        long double flux_it=0.L; // weight that reaches A in this iteration
+        int n_ab_it=0;
+        #pragma omp parallel
+        {
+        Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+        long double flux_local=0.L; int n_ab_local=0;
+        #pragma omp for schedule(dynamic)
+        for (int i=0;i<static_cast<int>(walkers.size());i++) {
+            Task_rng task_rng(seed,n_wekmcit,i); // random numbers for a walker do not depend on the thread that propagates it
+            propagate_walker(ktn,traj_method_local,walkers[i],tau_r,flux_local,n_ab_local);
+        }
+        #pragma omp critical
+        { flux_it+=flux_local; n_ab_it+=n_ab_local; }
+        delete traj_method_local;
         }
+        flux_a+=flux_it; n_ab+=n_ab_it;
+        we_resampling(ktn,n_wekmcit);
+        flux_f << setw(10) << n_wekmcit << setw(20) << tau_r << setw(10) << walkers.size() << setw(10) << n_ab_it \
+               << setw(20) << flux_it << setw(20) << flux_it/static_cast<long double>(taure) << setw(20) << flux_a/tau_r << "\n";
+        if (debug) cout << "wekmc> iteration " << n_wekmcit << " time: " << tau_r << " no. of walkers: " << walkers.size() \
+                        << " flux into A: " << flux_it << endl;
+        n_wekmcit++;
         tau_r += taure;
-        break;
     }
-    cout << "wekmc> finished WE-kMC simulation" << endl;
+    cout << "wekmc> finished WE-kMC simulation after " << n_wekmcit << " iterations. " << n_ab << " walkers reached A" << endl;
+    if (n_wekmcit>0) cout << "wekmc> estimated A<-B rate constant (total flux into A / total time): " \
+                          << flux_a/(static_cast<long double>(taure)*n_wekmcit) << endl;
+}
+
+/* propagate a walker until the resampling time. A walker that reaches A adds its weight to the flux into A, and is then recycled
+   to B (retaining its weight and the time of the ensemble) */
+void WE::propagate_walker(const Network &ktn, Traj_Method *traj_method_obj, Walker &walker, long double tau_r, \
+                          long double &flux, int &n_hits) {
+
+    while (walker.t<tau_r) {
+        const Node *prev_node=walker.prev_node, *curr_node=walker.curr_node;
+        unsigned long long int k=walker.k; long double p=walker.p, s=walker.s;
+        traj_method_obj->kmc_iteration(ktn,walker);
+        if (!discretetime && walker.t>tau_r) {
+            /* the waiting time distribution is memoryless, so the step that exceeds the resampling time is discarded and the walker
+               instead remains at its current node until the resampling time */
+            walker.prev_node=prev_node; walker.curr_node=curr_node; walker.k=k; walker.p=p; walker.s=s;
+            walker.t=tau_r;
+            break;
+        }
+        if (walker.curr_node->aorb==-1) {
+            flux+=walker.weight; n_hits++;
+            long double t=walker.t;
+            walker.reset_walker_info();
+            walker.t=t; walker.path_no++;
+            get_initial_node(ktn,walker,seed);
+        }
+    }
 }
 
-void WE::we_resampling() {
+/* the walkers are grouped by the communities that they occupy, and the walkers in each community are split or merged in parallel,
+   so that the number of walkers in each occupied community is equal to its target number. The total weight is conserved */
+void WE::we_resampling(const Network &ktn, int n_wekmcit) {
 
     if (debug) cout << "wekmc> resampling trajectories" << endl;
+    vector<vector<Walker>> comm_walkers(ktn.ncomms);
+    for (const Walker &walker: walkers) comm_walkers[walker.curr_node->comm_id].push_back(walker);
+    #pragma omp parallel for schedule(dynamic)
+    for (int i=0;i<ktn.ncomms;i++) {
+        Task_rng task_rng(seed,-n_wekmcit-2,i);
+        resample_comm(comm_walkers[i],commstargs[i]);
+    }
+    vector<int> offsets(ktn.ncomms+1,0); // position of the walkers of each community in the resampled list of walkers
+    for (int i=0;i<ktn.ncomms;i++) offsets[i+1]=offsets[i]+comm_walkers[i].size();
+    walkers.resize(offsets[ktn.ncomms]);
+    #pragma omp parallel for
+    for (int i=0;i<ktn.ncomms;i++) {
+        for (int j=0;j<static_cast<int>(comm_walkers[i].size());j++) {
+            walkers[offsets[i]+j]=comm_walkers[i][j];
+            walkers[offsets[i]+j].walker_id=offsets[i]+j; }
+    }
+}
+
+/* split the walkers of highest weight and merge the walkers of lowest weight in a community until the number of walkers is
+   equal to the target number (at least one walker is retained in an occupied community). When two walkers are merged, one of
+   them is retained, with probability proportional to its weight, and is assigned their combined weight */
+void WE::resample_comm(vector<Walker> &comm_walkers, int ntarg) {
+
+    if (comm_walkers.empty()) return;
+    ntarg=max(ntarg,1);
+    while (static_cast<int>(comm_walkers.size())>ntarg) {
+        int i=0, j=1; // indices of walkers of lowest and second-lowest weight
+        if (comm_walkers[j].weight<comm_walkers[i].weight) swap(i,j);
+        for (int l=2;l<static_cast<int>(comm_walkers.size());l++) {
+            if (comm_walkers[l].weight<comm_walkers[i].weight) { j=i; i=l;
+            } else if (comm_walkers[l].weight<comm_walkers[j].weight) { j=l; }
+        }
+        long double weight=comm_walkers[i].weight+comm_walkers[j].weight;
+        int keep=(rand_unif_met(seed)*weight<comm_walkers[i].weight)?i:j, discard=(keep==i)?j:i;
+        comm_walkers[keep].weight=weight;
+        if (discard!=static_cast<int>(comm_walkers.size())-1) comm_walkers[discard]=comm_walkers.back();
+        comm_walkers.pop_back();
+    }
+    while (static_cast<int>(comm_walkers.size())<ntarg) {
+        vector<Walker>::iterator it_max = max_element(comm_walkers.begin(),comm_walkers.end(), \
+            [](const Walker &a, const Walker &b) { return a.weight<b.weight; });
+        it_max->weight/=2.L;
+        Walker walker=*it_max; // copy before the list of walkers is reallocated
+        comm_walkers.push_back(walker);
+    }
 }